@@ -19,15 +19,22 @@
 
 #include "resoundnv/behaviour.hpp"
 #include "resoundnv/core.hpp"
+#include <fcntl.h>
+#include <unistd.h>
 
 void BRouteSet::create_route(const BufferRef& a, const BufferRef& b, float gain){
     if( a.isBus ) { throw Exception("Route source is not a behaviour output."); }
     if( !b.isBus ) { throw Exception("Route destination is not a bus."); }
     std::cout << "Found route 1 to 1 : " << a.id << " to " << b.id << std::endl;
     routes_.push_back(BRoute(a.buffer,b.buffer, gain ));
+    ++size_;
 }
 
-BRouteSet::BRouteSet(const xmlpp::Node* node){
+BRouteSet::BRouteSet(const xmlpp::Node* node, BRouteArray& routes) :
+		routes_(routes),
+		first_(routes.size()),
+		size_(0)
+{
 	// a routeset works a little bit like a collective
 	// it contains any number of routes grouped together
 	std::cout << "Found route set" << std::endl;
@@ -85,27 +92,62 @@ BRouteSet::BRouteSet(const xmlpp::Node* node){
 	}
 }
 
-BParam::BParam(float& v, float startingValue) : value_(v){
+BParam::BParam(float& v, float startingValue, SmoothedValue* smoother) :
+		value_(v),
+		pendingValue_(startingValue),
+		queued_(0),
+		smoother_(smoother),
+		rampTime_(-1.0f)
+{
 	value_ = startingValue; // remember that this is a reference
+	if(smoother_) smoother_->jump(startingValue);
 }
 void BParam::init_from_xml(const xmlpp::Element* nodeElement){
 	addr_ = get_optional_attribute_string(nodeElement,"address");
 	value_ = get_optional_attribute_float(nodeElement,"value");
+	rampTime_ = get_optional_attribute_float(nodeElement,"ramp", -1.0f);
+	// the starting value is not ramped to
+	if(smoother_) smoother_->jump(value_);
 	// at this point we should register the parameter address with osc
 	if(addr_ != ""){
-		SESSION().add_method(addr_,"f", BParam::lo_cb_params, this);
+		SESSION().register_parameter_address(this);
 	}
 }
 
+void BParam::init_ramp(float defaultMs, float sampleRate){
+	if(smoother_) smoother_->set_ramp_time(rampTime_ < 0.0f ? defaultMs : rampTime_, sampleRate);
+}
+
 int BParam::lo_cb_params(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data){
 	BParam* param = static_cast<BParam*>(user_data);
-	param->value_ = argv[0]->f; // TODO validation here required
+	// every message for the address arrives here, liblo no longer checks the types
+	float value;
+	if(argc < 1) return 1;
+	switch(types[0]){
+		case 'f': value = argv[0]->f; break;
+		case 'i': value = (float)argv[0]->i; break;
+		case 'd': value = (float)argv[0]->d; break;
+		default: return 1;
+	}
+	lo_timetag when = lo_message_get_timestamp(data);
+	if(when.sec == 0 && when.frac <= 1){
+		// not timetagged, the dsp thread picks this up at the start of its next block
+		SESSION().get_param_queue().post(param, value);
+	} else {
+		// from a timetagged bundle, the dsp thread applies it on the matching frame
+		SESSION().schedule_parameter(param, value, when);
+	}
 	//std::cout << "OSC BParam "<< path<< " " <<param->value_<< std::endl; // debug print
     return 1;
 }
 
-Behaviour::Behaviour() 
-{}
+Behaviour::Behaviour() :
+		bypass_(0.0f),
+		bypassed_(false),
+		metered_(false)
+{
+	register_parameter("bypass",new BParam(bypass_,0.0f));
+}
 Behaviour::~Behaviour(){
     for(int n = 0; n < buffers_.size(); ++n){
         delete buffers_[n];
@@ -134,9 +176,19 @@ void Behaviour::init_from_xml(const xmlpp::Element* nodeElement){
 			}
 		}
 	}
+	for(BParamMap::iterator it = params_.begin(); it != params_.end(); ++it){
+		it->second->init_ramp(SESSION().get_options().rampTime_, SESSION().get_sample_rate());
+	}
+	metered_ = get_optional_attribute_string(nodeElement, "meter", "false") == "true";
 	DynamicObject::init_from_xml(nodeElement);
 }
 
+VUMeter& Behaviour::get_vu_meter(int n){
+	// buffers are all created by the time a program is compiled, the meters are sized once
+	if(meters_.size() != buffers_.size()) meters_.resize(buffers_.size());
+	return meters_[n];
+}
+
 
 void Behaviour::register_parameter(ObjectId id, BParam* param){
 	BParamMap::iterator it = params_.find(id);
@@ -148,12 +200,33 @@ void Behaviour::register_parameter(ObjectId id, BParam* param){
 	}
 }
 
+void Behaviour::virtual_process(void* object, jack_nframes_t offset, jack_nframes_t nframes){
+	static_cast<Behaviour*>(object)->process(offset, nframes);
+}
+
+void Behaviour::virtual_control(void* object, jack_nframes_t offset, jack_nframes_t nframes){
+	static_cast<Behaviour*>(object)->process_control(offset, nframes);
+}
+
+void Behaviour::get_buffer_usage(AudioBufferSet& reads, AudioBufferSet& writes){
+	for(unsigned int n = 0; n < buffers_.size(); ++n){
+		writes.insert(buffers_[n]);
+	}
+}
+
+void Behaviour::enter_bypass(){
+	for(unsigned int n = 0; n < buffers_.size(); ++n){
+		buffers_[n]->clear();
+		buffers_[n]->set_silent(true);
+	}
+}
+
 AudioBuffer* Behaviour::create_buffer(ObjectId subId, ObjectId forceId){
 // TODO: nasty joink here, forcing ids is not that nice but is sometimes nessersary
 // consider a redesign.
     AudioBuffer* b = new AudioBuffer();
     jack_nframes_t s = SESSION().get_buffer_size();
-    b->allocate(s);
+    b->allocate(s, &SESSION().get_buffer_arena());
     BufferRef ref;
     std::stringstream str;
     ObjectId id = get_id(); // this may be "" if the behaviour has not yet initialised from xml
@@ -174,124 +247,202 @@ AudioBuffer* Behaviour::create_buffer(ObjectId subId, ObjectId forceId){
 }
 
 // ---------------------------------------
+/// bytes a sample takes up in the file, compressed formats are taken as the largest pcm
+static size_t sample_bytes(int format){
+	switch(format & SF_FORMAT_SUBMASK){
+	case SF_FORMAT_PCM_S8:
+	case SF_FORMAT_PCM_U8: return 1;
+	case SF_FORMAT_PCM_16: return 2;
+	case SF_FORMAT_PCM_24: return 3;
+	case SF_FORMAT_DOUBLE: return 8;
+	default: return 4;
+	}
+}
+
 Diskstream::Diskstream() :
-		ringBuffer_(0),
 		diskBuffer_(0),
-		copyBuffer_(0),
-		playing_(true)
+		channelBuffer_(0),
+		file_(0),
+		fd_(-1),
+		chunkBytes_(0),
+		firstChannel_(0),
+		channelCount_(1),
+		playing_(true),
+		lowWater_(0),
+		underruns_(0)
 {}
 
 void Diskstream::init_from_xml(const xmlpp::Element* nodeElement){
 	// diskstream maintains a jack ring buffer and two process functions are called from seperate threads
 	// create a ring buffer
 	// open the file for reading
-	// check channels and assert mono
-	// read as much as possible into the ring buffer
+	// one buffer per channel streamed, channel="n" picks a single channel (from 1) of a multichannel file
+	// read as much as possible into the ring buffers
 
 	path_ = get_attribute_string(nodeElement,"source");
         gain_ = get_optional_attribute_float(nodeElement,"gain", 1.0);
+	int channel = (int)get_optional_attribute_float(nodeElement,"channel", 0.0f);
 
-	ringBuffer_ = jack_ringbuffer_create(DISK_STREAM_RING_BUFFER_SIZE*sizeof(float));
-	copyBuffer_ = new float[DISK_STREAM_RING_BUFFER_SIZE];
-	memset(copyBuffer_, 0, DISK_STREAM_RING_BUFFER_SIZE * sizeof(float));
-	memset(ringBuffer_->buf, 0, ringBuffer_->size); // clear the buffer
-
-	diskBuffer_ = new float[DISK_STREAM_RING_BUFFER_SIZE]; // TODO de-interleaving, really needs an audio pool to be efficient
-	memset(diskBuffer_, 0, DISK_STREAM_RING_BUFFER_SIZE * sizeof(float)); // clear the buffer
-
-	file_ = sf_open(path_.c_str(), SFM_READ, &info_);
-	if(!file_){
+	// opened here rather than by libsndfile so the kernel can be told how the file will be read
+	fd_ = open(path_.c_str(), O_RDONLY);
+	if(fd_ < 0){
 		throw Exception("Disk stream cannot load file, does it exist?");
 	}
-	if(info_.channels > 1){
-		throw Exception("Disk stream cannot load multichannel audio files, use split mono.");
+	posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+	memset(&info_, 0, sizeof(info_));
+	file_ = sf_open_fd(fd_, SFM_READ, &info_, 1); // closes fd_ with it
+	if(!file_){
+		close(fd_);
+		fd_ = -1;
+		throw Exception("Disk stream cannot load file, is it a sound file?");
+	}
+	if(channel < 0 || channel > info_.channels){
+		throw Exception("Disk stream channel is not in the file, channels count from 1.");
+	}
+	firstChannel_ = channel ? channel - 1 : 0;
+	channelCount_ = channel ? 1 : info_.channels;
+
+	// read ahead by the seconds asked for, but always by a couple of blocks.
+	// a quarter of it is read at a time, large reads keep a disk serving many streams seeking less
+	ringFrames_ = (size_t)(SESSION().get_options().readAhead_ * SESSION().get_sample_rate());
+	ringFrames_ = std::max(ringFrames_, std::max((size_t)SESSION().get_buffer_size() * 2, DISK_STREAM_MIN_CHUNK * 4));
+	chunkFrames_ = std::min(std::max(ringFrames_ / 4, DISK_STREAM_MIN_CHUNK), DISK_STREAM_MAX_CHUNK);
+	lowWater_ = ringFrames_;
+
+	for(int c = 0; c < channelCount_; ++c){
+		// one spare frame, a jack ring buffer holds one byte less than its size
+		jack_ringbuffer_t* ring = jack_ringbuffer_create((ringFrames_ + 1)*sizeof(float));
+		jack_ringbuffer_mlock(ring); // the dsp thread reads it
+		memset(ring->buf, 0, ring->size); // clear the buffer
+		ringBuffers_.push_back(ring);
+	}
+
+	// every channel of the file is read in one go and split up, whether streamed or not
+	diskBuffer_ = new float[chunkFrames_ * info_.channels];
+	memset(diskBuffer_, 0, chunkFrames_ * info_.channels * sizeof(float)); // clear the buffer
+	channelBuffer_ = new float[chunkFrames_ * info_.channels];
+	chunkBytes_ = chunkFrames_ * info_.channels * sample_bytes(info_.format);
+	for(int c = 0; c < info_.channels; ++c){
+		channelPtrs_.push_back(channelBuffer_ + c * chunkFrames_);
 	}
 
 	disk_process();
 
 	Behaviour::init_from_xml(nodeElement);
 
-        create_buffer();
+	// stem.0 to stem.N-1, a route from stem reaches every channel
+	for(int c = 0; c < channelCount_; ++c){
+        	create_buffer();
+	}
 }
 
 Diskstream::~Diskstream(){
-	// free ring buffer, disk buffer and file
-	jack_ringbuffer_free(ringBuffer_);
+	// free ring buffers, disk buffers and file
+	for(unsigned int c = 0; c < ringBuffers_.size(); ++c){
+		jack_ringbuffer_free(ringBuffers_[c]);
+	}
 	if(diskBuffer_) delete [] diskBuffer_;
-	sf_close(file_);
-}
-
-void Diskstream::disk_process(){
-	// find out how much space is on the ring buffer available for writing
-	// read that much from disk and copy into ring buffer
-
-	if(!playing_){return;}
-
-	size_t bytesToWrite = jack_ringbuffer_write_space(ringBuffer_);
-	if(bytesToWrite > 4096){
-		bytesToWrite = 1024;
-		size_t framesToWrite = bytesToWrite/sizeof(float);
-		if (bytesToWrite > 0){
-			//printf("bytesToWrite = %i\n",bytesToWrite);
-			size_t frames = sf_readf_float(file_, diskBuffer_, framesToWrite);
-			// TODO de-interleaving, really needs an audio pool to be efficient
-			if( frames < framesToWrite){
-				printf("Silence\n");
-				// fill with silence, happens at end of file and thereafter
-				for(size_t n = frames; n < framesToWrite; ++n){
-					diskBuffer_[n] = 0.0f;
-				}
-			}
-			//avg_signal_in_buffer(diskBuffer_,framesToWrite); // audio tested and arrives here
-			size_t bytesWritten = jack_ringbuffer_write(ringBuffer_, (char*)diskBuffer_, bytesToWrite);
-			//printf("DiskBuffer read %i frames from disk and wrote %i bytes\n",frames,bytesWritten);
+	if(channelBuffer_) delete [] channelBuffer_;
+	if(file_) sf_close(file_);
+}
+
+size_t Diskstream::get_free_frames(){
+	// the rings are written together, the dsp thread may have read less from the later ones so far
+	size_t bytes = 0;
+	for(int c = 0; c < channelCount_; ++c){
+		bytes = std::max(bytes, jack_ringbuffer_read_space(ringBuffers_[c]));
+	}
+	size_t frames = bytes / sizeof(float);
+	return frames < ringFrames_ ? ringFrames_ - frames : 0;
+}
+
+void Diskstream::read_chunk(){
+	size_t framesToWrite = chunkFrames_;
+	size_t bytesToWrite = framesToWrite * sizeof(float);
+	// one read for every channel
+	size_t frames = sf_readf_float(file_, diskBuffer_, framesToWrite);
+	if( frames < framesToWrite){
+		// fill with silence, happens at end of file and thereafter
+		memset(diskBuffer_ + frames * info_.channels, 0, (framesToWrite - frames) * info_.channels * sizeof(float));
+	} else {
+		// have the kernel start on the next chunk in the background. with many streams the disk gets
+		// the next read of every one of them queued at once and can order them, and the read that
+		// follows comes from the page cache rather than waiting on a seek
+		off_t pos = lseek(fd_, 0, SEEK_CUR);
+		if(pos >= 0) posix_fadvise(fd_, pos, chunkBytes_, POSIX_FADV_WILLNEED);
+	}
+	//avg_signal_in_buffer(diskBuffer_,framesToWrite); // audio tested and arrives here
+	if(info_.channels == 1){
+		jack_ringbuffer_write(ringBuffers_[0], (char*)diskBuffer_, bytesToWrite);
+	} else {
+		ab_deinterleave(diskBuffer_, &channelPtrs_[0], info_.channels, framesToWrite);
+		for(int c = 0; c < channelCount_; ++c){
+			jack_ringbuffer_write(ringBuffers_[c], (char*)channelPtrs_[firstChannel_ + c], bytesToWrite);
 		}
 	}
+}
 
-	// this function is only worth calling if a jack process has happened so we use cond_wait for this in master thread
-	// however this function is also called on init so we cant wait here.
+size_t Diskstream::disk_process(){
+	// only a whole chunk is read, the disk thread comes back once the dsp thread has made room
+	if(!wants_read()) return 0;
+	read_chunk();
+	return chunkFrames_;
 }
 
-void Diskstream::process(jack_nframes_t nframes){
+void Diskstream::process(jack_nframes_t offset, jack_nframes_t nframes){
 	// find out how much space is available for reading on the buffer
 	// if we have enough for the whole block we are ok
 	// otherwise we have to call it a buffer underrun
 	// write as much as we can then fill with zeros
 	// The problem here is that this disk stream will now be out of playback sync by a number of samples
 	// we need to skip those on the next buffer, is there any point attempting to get back in sync? we have already glitched
-	//float tbuffer[4096];
 
-	if(!playing_){return;}
+	if(!playing_){
+		for(int c = 0; c < channelCount_; ++c) get_buffer(c).silence(offset, nframes);
+		return;
+	}
 
 	size_t bytesToRead = nframes * sizeof(float);
-	//printf("bytesToRead = %i\n",bytesToRead);
-	size_t rSpace = jack_ringbuffer_read_space (ringBuffer_);
+	// the channels are written one after another, the last ring written may hold the least
+	size_t rSpace = jack_ringbuffer_read_space (ringBuffers_[channelCount_ - 1]);
+	if(rSpace / sizeof(float) < lowWater_) lowWater_ = rSpace / sizeof(float);
 	if(rSpace >= bytesToRead){
-		size_t bytesRead = jack_ringbuffer_read (ringBuffer_, (char*)copyBuffer_, bytesToRead);
-		ab_copy_with_gain(copyBuffer_, get_buffer(0).get_buffer(),nframes, gain_);
-		//size_t bytesRead = jack_ringbuffer_read (ringBuffer_, (char*)tbuffer, bytesToRead);
-		//TODO gain should be applied here
-		//printf("Buffer read %i bytes, from %i available\n",bytesRead, rSpace);
+		for(int c = 0; c < channelCount_; ++c){
+			AudioBuffer& out = get_buffer(c);
+			float* dest = out.get_buffer() + offset;
+			jack_ringbuffer_read (ringBuffers_[c], (char*)dest, bytesToRead);
+			// the end of the file and beyond is read as zeros
+			if(gain_ == 0.0f || ab_is_silent(dest, nframes)){
+				out.silence(offset, nframes);
+			} else {
+				if(gain_ != 1.0f) ab_copy_with_gain(dest, dest, nframes, gain_);
+				out.set_silent(false);
+			}
+		}
 	} else {
 		// buffer underrun
-		printf("Buffer underrun!\n");
+		// counted rather than printed, see /resound/diskstreams
+		for(int c = 0; c < channelCount_; ++c) get_buffer(c).silence(offset, nframes);
+		++underruns_;
 	}
-	//avg_signal_in_buffer(get_buffer()->get_buffer(),nframes);
-	//avg_signal_in_buffer(tbuffer,nframes);
-	//get_vu_meter().analyse_buffer(get_buffer(0).get_buffer(),nframes);
-
 }
 
 void Diskstream::seek(size_t pos){
 	sf_seek(file_, pos, SEEK_SET);
+	lowWater_ = ringFrames_;
 }
 
 void Diskstream::play(){
+	// a stopped stream is empty, have a chunk waiting so the first block does not underrun
+	if(!playing_ && get_free_frames() >= chunkFrames_) read_chunk();
+	lowWater_ = ringFrames_;
 	playing_ = true;
 }
 void Diskstream::stop(){
 	playing_ = false;
-	jack_ringbuffer_reset(ringBuffer_);
+	for(unsigned int c = 0; c < ringBuffers_.size(); ++c){
+		jack_ringbuffer_reset(ringBuffers_[c]);
+	}
 
 }
 
@@ -302,22 +453,39 @@ void Livestream::init_from_xml(const xmlpp::Element* nodeElement){
 	connectionName_ = get_attribute_string(nodeElement,"port");
 	ObjectId id = get_attribute_string(nodeElement,"id");
         gain_ = get_optional_attribute_float(nodeElement,"gain", 1.0);
-	port_ = new JackPort(id, JackPortIsInput ,&SESSION());
+	port_ = SESSION().create_port(id, JackPortIsInput);
 	port_->connect(connectionName_);
 	std::cout << "Livestream " << id << std::endl;
 
 	Behaviour::init_from_xml(nodeElement);
         create_buffer();
 }
-void Livestream::process(jack_nframes_t nframes){
+void Livestream::process(jack_nframes_t offset, jack_nframes_t nframes){
 	// copy from jack buffer applying gain
-	ab_copy_with_gain(port_->get_audio_buffer(nframes), get_buffer(0).get_buffer(),nframes, gain_);
+	float* in = port_->get_audio_buffer(SESSION().get_buffer_size()) + offset;
+	AudioBuffer& out = get_buffer(0);
+	if(gain_ == 0.0f || ab_is_silent(in, nframes)){
+		out.silence(offset, nframes);
+	} else {
+		ab_copy_with_gain(in, out.get_buffer() + offset,nframes, gain_);
+		out.set_silent(false);
+	}
 
 	//avg_signal_in_buffer(get_buffer()->get_buffer(),nframes); // sound tested here
-
-	//TODO optional vumetering
-	//get_vu_meter().analyse_buffer(get_buffer(0).get_buffer(),nframes);
 };
+
+void Livestream::alias_port(jack_nframes_t nframes){
+	float* in = port_->get_audio_buffer(nframes);
+	AudioBuffer& out = get_buffer(0);
+	out.alias(in, gain_);
+	out.set_silent(gain_ == 0.0f || ab_is_silent(in, nframes));
+}
+
+void Livestream::enter_bypass(){
+	// never clear the capture buffer
+	unalias_port();
+	Behaviour::enter_bypass();
+}
 // --------------------------------------
 
 RouteSetBehaviour::RouteSetBehaviour(){}
@@ -331,14 +499,66 @@ void RouteSetBehaviour::init_from_xml(const xmlpp::Element* nodeElement){
 		if(child){
 			std::string name = child->get_name();
 			if(name=="routeset"){
-				BRouteSet* routeSet = new BRouteSet(child);
+				BRouteSet* routeSet = new BRouteSet(child, routes_);
 				routeSets_.push_back(routeSet);
 			}
 		}
 	}
+	// routes ramp to every new level, over ramp ms if given
+	float ramp = get_optional_attribute_float(nodeElement, "ramp", SESSION().get_options().rampTime_);
+	for(unsigned int n = 0; n < routes_.size(); ++n){
+		routes_[n].set_ramp_time(ramp, SESSION().get_sample_rate());
+	}
 	Behaviour::init_from_xml(nodeElement);
 }
 
+void RouteSetBehaviour::set_route_levels(BRouteSetArray& routeSets, const std::vector<float>& routeSetGains){
+	for(unsigned int s = 0; s < routeSets.size(); ++s){
+		BRouteRange routes = routeSets[s]->get_routes();
+		for(unsigned int n = 0; n < routes.size(); ++n){
+			routes[n].set_level(routes[n].get_gain() * routeSetGains[s]);
+		}
+	}
+}
+
+void RouteSetBehaviour::sum_routes(BRouteRange routes, jack_nframes_t offset, jack_nframes_t nframes, int lane){
+	for(unsigned int n = 0; n < routes.size(); ++n){
+		BRoute& route = routes[n];
+		if(!route.in_lane(lane)) continue;
+		AudioBuffer* from = route.get_from();
+		AudioBuffer* to = route.get_to();
+		float start, step;
+		size_t ramp = route.advance_level(nframes, start, step);
+
+		// nothing to add from a silent source, or a route faded out and staying out
+		if(from->is_silent() || (ramp == 0 && start == 0.0f)) continue;
+		ab_sum_with_gain_ramp(from->get_buffer() + offset, to->get_buffer() + offset, nframes, start, step, ramp);
+		to->set_silent(false);
+	}
+}
+
+void RouteSetBehaviour::get_buffer_usage(AudioBufferSet& reads, AudioBufferSet& writes){
+	Behaviour::get_buffer_usage(reads, writes);
+	for(unsigned int n = 0; n < routes_.size(); ++n){
+		reads.insert(routes_[n].get_from());
+		writes.insert(routes_[n].get_to());
+	}
+}
+
+void RouteSetBehaviour::enter_bypass(){
+	Behaviour::enter_bypass();
+	for(unsigned int n = 0; n < routes_.size(); ++n){
+		routes_[n].set_level(0.0f);
+	}
+}
+
+void RouteSetBehaviour::assign_bus_lanes(const BusLaneMap& lanes){
+	for(unsigned int n = 0; n < routes_.size(); ++n){
+		BusLaneMap::const_iterator it = lanes.find(routes_[n].get_to());
+		routes_[n].set_lane(it != lanes.end() ? it->second : 0);
+	}
+}
+
 IOHelper::IOHelper(){}
 void IOHelper::init_from_xml(const xmlpp::Element* nodeElement){
 	// TODO Although basic inputs and outputs are created this does not consider cass or cls as groups
@@ -368,26 +588,40 @@ void IOHelper::init_from_xml(const xmlpp::Element* nodeElement){
 	}
 }
 
-void AttBehaviour::process(jack_nframes_t nframes){
-	// ok we would get all the routes for the first routeset
-	// then we do buffer copy for each one applying our current gain setting
+void IOHelper::get_buffer_usage(AudioBufferSet& reads, AudioBufferSet& writes){
+	for(unsigned int n = 0; n < inputs_.size(); ++n){
+		reads.insert(inputs_[n]);
+	}
+	for(unsigned int n = 0; n < outputs_.size(); ++n){
+		writes.insert(outputs_[n]->get_buffer());
+	}
+}
+
+void AttBehaviour::process(jack_nframes_t offset, jack_nframes_t nframes){
+	process_control(offset, nframes);
+	process_lane(offset, nframes, ALL_LANES);
+}
+
+void AttBehaviour::process_control(jack_nframes_t offset, jack_nframes_t nframes){
 	float level = level_;
 	// only interested in the first routeset
 	BRouteSetArray& routeSets = get_route_sets();
 	if(routeSets.size() > 0){
-		BRouteArray& routes = routeSets[0]->get_routes();
+		BRouteRange routes = routeSets[0]->get_routes();
 		for(unsigned int n = 0; n < routes.size(); ++n){
-			AudioBuffer* from = routes[n].get_from();
-
-			//printf("Route %i from",n); avg_signal_in_buffer(from->get_buffer(),nframes); // signal tested to here
-			AudioBuffer* to = routes[n].get_to();
-			float gain = routes[n].get_gain();
-			ab_sum_with_gain(from->get_buffer(), to->get_buffer(), nframes, gain * level);
-			//std::cout << "AttBehaviour::process - single route" << std::endl;
-
-			//printf("Route %i to",n); avg_signal_in_buffer(to->get_buffer(),nframes); // signal tested to here
+			routes[n].set_level(routes[n].get_gain() * level);
 		}
 	}
+}
+
+void AttBehaviour::process_lane(jack_nframes_t offset, jack_nframes_t nframes, int lane){
+	// ok we would get all the routes for the first routeset
+	// then we do buffer copy for each one applying the level set at control rate
+	// only interested in the first routeset
+	BRouteSetArray& routeSets = get_route_sets();
+	if(routeSets.size() > 0){
+		sum_routes(routeSets[0]->get_routes(), offset, nframes, lane);
+	}
 	//std::cout << "AttBehaviour::process" << std::endl;
 }
 
@@ -411,11 +645,14 @@ void MultipointCrossfadeBehaviour::init_from_xml(const xmlpp::Element* nodeEleme
 
 	hannFunction = LookupTable::create_hann(HANN_TABLE_SIZE);
 	RouteSetBehaviour::init_from_xml(nodeElement);	
+	routeSetGains_.resize(get_route_sets().size(), 0.0f);
+}
+void MultipointCrossfadeBehaviour::process(jack_nframes_t offset, jack_nframes_t nframes){
+	process_control(offset, nframes);
+	process_lane(offset, nframes, ALL_LANES);
 }
-void MultipointCrossfadeBehaviour::process(jack_nframes_t nframes){
-
-
 
+void MultipointCrossfadeBehaviour::process_control(jack_nframes_t offset, jack_nframes_t nframes){
 	BRouteSetArray& routeSets = get_route_sets();
 	int numRoutes = routeSets.size();
 	float N = (float)numRoutes;
@@ -423,33 +660,18 @@ void MultipointCrossfadeBehaviour::process(jack_nframes_t nframes){
 	// offset factor (1-1/f)/(N-1)*f
 	float offsetFactor = (1.0f - 1.0f/f)/(N-1.0f)*f;
 
-	if(numRoutes > 0){
-		for(int setNum = 0; setNum < numRoutes; ++setNum){
-			float i = zero_outside_bounds( position_ - offsetFactor * (float)setNum, 0.0f, 1.0f);
-			float routeSetGain = hannFunction->lookup_linear(i * (float)HANN_TABLE_SIZE ) * gain_;
-
-			BRouteArray& routes = routeSets[setNum]->get_routes();
-
-			// dsp for each route
-			for(unsigned int n = 0; n < routes.size(); ++n){
-				// old gain data is stored in the userData
-				float* oldGain = (float*)routes[n].get_user_data();
-				if(!oldGain) {
-					oldGain	= new float(0.0f);
-					routes[n].set_user_data(oldGain);
-				}
-				AudioBuffer* from = routes[n].get_from();
-				AudioBuffer* to = routes[n].get_to();
-				float gain = routes[n].get_gain() * routeSetGain;
-
-				ab_sum_with_gain_linear_interp(from->get_buffer(), to->get_buffer(), nframes, gain, *oldGain, 128);
-				*oldGain = gain;
-			}
-		}
+	for(int setNum = 0; setNum < numRoutes; ++setNum){
+		float i = zero_outside_bounds( position_ - offsetFactor * (float)setNum, 0.0f, 1.0f);
+		routeSetGains_[setNum] = hannFunction->lookup_linear(i * (float)HANN_TABLE_SIZE ) * gain_;
 	}
+	set_route_levels(routeSets, routeSetGains_);
+}
 
+void MultipointCrossfadeBehaviour::process_lane(jack_nframes_t offset, jack_nframes_t nframes, int lane){
+	// every routeset has set its levels, the routes of all of them are one array
+	sum_routes(get_routes(), offset, nframes, lane);
 }
-ChaseBehaviour::ChaseBehaviour() : phasor(44100.0f/128.0f,1){
+ChaseBehaviour::ChaseBehaviour() : phasor(44100.0f,1){
 	register_parameter("freq",new BParam(freq_,1.0f));
 	register_parameter("phase",new BParam(phase_,0.0f));
 	register_parameter("gain",new BParam(gain_,0.0));
@@ -461,9 +683,18 @@ void ChaseBehaviour::init_from_xml(const xmlpp::Element* nodeElement){
 	std::cout << "Created ChaseBehaviour routeset behaviour object!" << std::endl;
 	// this is based on the multipoint crossfader but uses a phasor to control position
 	RouteSetBehaviour::init_from_xml(nodeElement);
+	routeSetGains_.resize(get_route_sets().size(), 0.0f);
+	// the phasor runs at the sample rate and is advanced by the frames processed,
+	// so the chase speed does not depend on the block size or on sub block splits
+	phasor = Phasor((float)SESSION().get_sample_rate(), freq_);
 	phasor.set_phase(phase_);
 }
-void ChaseBehaviour::process(jack_nframes_t nframes){
+void ChaseBehaviour::process(jack_nframes_t offset, jack_nframes_t nframes){
+	process_control(offset, nframes);
+	process_lane(offset, nframes, ALL_LANES);
+}
+
+void ChaseBehaviour::process_control(jack_nframes_t offset, jack_nframes_t nframes){
 
 	BRouteSetArray& routeSets = get_route_sets();
 	int numRoutes = routeSets.size();
@@ -473,7 +704,7 @@ void ChaseBehaviour::process(jack_nframes_t nframes){
 
 	// the chase gets its position from the phasor
 	float phase = clip(phasor.get_phase(),0,1);
-	phasor.tick();
+	phasor.advance(nframes);
 
 	float f = slope_;
 
@@ -481,28 +712,15 @@ void ChaseBehaviour::process(jack_nframes_t nframes){
 		float offsetFactor = 1.0f / N;
 		for(int setNum = 0; setNum < numRoutes; ++setNum){	
 			float p = wrap(phase - setNum*offsetFactor) * TWOPI;
-			float routeSetGain = pow(cos(p) * 0.5f + 0.5f,f) * gain_;
-
-			BRouteArray& routes = routeSets[setNum]->get_routes();
-
-			// dsp for each route
-			for(unsigned int n = 0; n < routes.size(); ++n){
-				// old gain data is stored in the userData
-				float* oldGain = (float*)routes[n].get_user_data();
-				if(!oldGain) {
-					oldGain	= new float(0.0f);
-					routes[n].set_user_data(oldGain);
-				}
-				AudioBuffer* from = routes[n].get_from();
-				AudioBuffer* to = routes[n].get_to();
-				float gain = routes[n].get_gain() * routeSetGain;
-
-				ab_sum_with_gain_linear_interp(from->get_buffer(), to->get_buffer(), nframes, gain, *oldGain, 128);
-				*oldGain = gain;
-			}
+			routeSetGains_[setNum] = pow(cos(p) * 0.5f + 0.5f,f) * gain_;
 		}
 	}
+	set_route_levels(routeSets, routeSetGains_);
+}
 
+void ChaseBehaviour::process_lane(jack_nframes_t offset, jack_nframes_t nframes, int lane){
+	// every routeset has set its levels, the routes of all of them are one array
+	sum_routes(get_routes(), offset, nframes, lane);
 }
 
 AmpPanBehaviour::AmpPanBehaviour(){
@@ -519,35 +737,76 @@ void AmpPanBehaviour::init_from_xml(const xmlpp::Element* nodeElement){
 	// identify the number off outputs and get each ones gain
 	// setup storage for previous gain suitable for interpolation
 	IOHelper::LoudspeakerArray& outputs = io_.get_outputs();
-	oldGains_ = new float[outputs.size()];
+	gains_.resize(outputs.size());
+	float ramp = get_optional_attribute_float(nodeElement, "ramp", SESSION().get_options().rampTime_);
 	for(unsigned int n = 0; n < outputs.size(); ++n){
-		oldGains_[n] = 0.0f;
+		gains_[n].set_ramp_time(ramp, SESSION().get_sample_rate());
 	}
+	lanes_.resize(outputs.size(), 0);
 	assert(io_.get_inputs().size() > 0);
 	
 	Behaviour::init_from_xml(nodeElement);
 }
 
-void AmpPanBehaviour::process(jack_nframes_t nframes){
+void AmpPanBehaviour::process(jack_nframes_t offset, jack_nframes_t nframes){
+	process_control(offset, nframes);
+	process_lane(offset, nframes, ALL_LANES);
+}
 
-	IOHelper::BufferArray& inputs = io_.get_inputs();
-	float* in = inputs[0]->get_buffer(); // ignore all others for now
+void AmpPanBehaviour::get_buffer_usage(AudioBufferSet& reads, AudioBufferSet& writes){
+	Behaviour::get_buffer_usage(reads, writes);
+	io_.get_buffer_usage(reads, writes);
+}
+
+void AmpPanBehaviour::assign_bus_lanes(const BusLaneMap& lanes){
+	IOHelper::LoudspeakerArray& outputs = io_.get_outputs();
+	for(unsigned int o = 0; o < outputs.size(); ++o){
+		BusLaneMap::const_iterator it = lanes.find(outputs[o]->get_buffer());
+		lanes_[o] = it != lanes.end() ? it->second : 0;
+	}
+}
+
+void AmpPanBehaviour::process_control(jack_nframes_t offset, jack_nframes_t nframes){
 	IOHelper::LoudspeakerArray& outputs = io_.get_outputs();
 	for(unsigned int o = 0; o < outputs.size(); ++o){
 		Vec3 dPos = pos_ - outputs[o]->get_position();
 		float D = dPos.mag();
 		D = D < 1.0f ? 1.0f : D;
 		// now use D
-		float gCoef = 1.0f/(D*D) * gain_;
+		gains_[o].set_target(1.0f/(D*D) * gain_);
+	}
+}
+
+void AmpPanBehaviour::process_lane(jack_nframes_t offset, jack_nframes_t nframes, int lane){
+
+	IOHelper::BufferArray& inputs = io_.get_inputs();
+	bool silent = inputs[0]->is_silent();
+	float* in = inputs[0]->get_buffer() + offset; // ignore all others for now
+	IOHelper::LoudspeakerArray& outputs = io_.get_outputs();
+	for(unsigned int o = 0; o < outputs.size(); ++o){
+		if(lane != ALL_LANES && lane != lanes_[o]) continue;
+		float start, step;
+		size_t ramp = gains_[o].advance(nframes, start, step);
 		// sum to buffer
-		ab_sum_with_gain_linear_interp(in, outputs[o]->get_buffer()->get_buffer(), nframes, gCoef, oldGains_[o], 128);
-		oldGains_[o] = gCoef;
+		if(!silent && (ramp != 0 || start != 0.0f)){
+			AudioBuffer* bus = outputs[o]->get_buffer();
+			ab_sum_with_gain_ramp(in, bus->get_buffer() + offset, nframes, start, step, ramp);
+			bus->set_silent(false);
+		}
+	}
+}
+
+void AmpPanBehaviour::enter_bypass(){
+	Behaviour::enter_bypass();
+	IOHelper::LoudspeakerArray& outputs = io_.get_outputs();
+	for(unsigned int o = 0; o < outputs.size(); ++o){
+		gains_[o].jump(0.0f);
 	}
 }
 
 
 GainInsertBehaviour::GainInsertBehaviour(){
-	register_parameter("gain",new BParam(gain_,1.0));
+	register_parameter("gain",new BParam(gain_,1.0,&gainRamp_));
 }
 
 void GainInsertBehaviour::init_from_xml(const xmlpp::Element* nodeElement){
@@ -564,15 +823,33 @@ void GainInsertBehaviour::init_from_xml(const xmlpp::Element* nodeElement){
         Behaviour::init_from_xml(nodeElement);
 }
 
-void GainInsertBehaviour::process(jack_nframes_t nframes){
+void GainInsertBehaviour::get_buffer_usage(AudioBufferSet& reads, AudioBufferSet& writes){
+	Behaviour::get_buffer_usage(reads, writes);
+	io_.get_buffer_usage(reads, writes);
+}
+
+void GainInsertBehaviour::process(jack_nframes_t offset, jack_nframes_t nframes){
 
         IOHelper::BufferArray& inputs = io_.get_inputs();
         int chans = inputs.size();
+        float start, step;
+        size_t ramp = gainRamp_.advance(nframes, start, step);
         for(int chan = 0; chan < chans; ++chan){
            
-            float* in = inputs[0]->get_buffer(); // ignore all others for now
-            float* out = get_buffer(chan).get_buffer();
-            ab_copy_with_gain(in, out, nframes, gain_);
+            AudioBuffer& out = get_buffer(chan);
+            if((ramp == 0 && start == 0.0f) || inputs[0]->is_silent()){
+                out.silence(offset, nframes);
+                continue;
+            }
+            float* in = inputs[0]->get_buffer() + offset; // ignore all others for now
+            if(ramp == 0){
+                ab_copy_with_gain(in, out.get_buffer() + offset, nframes, start);
+            } else {
+                // there is no copying ramp kernel, a ramp only lasts a few blocks
+                std::memset(out.get_buffer() + offset, 0, sizeof(float) * nframes);
+                ab_sum_with_gain_ramp(in, out.get_buffer() + offset, nframes, start, step, ramp);
+            }
+            out.set_silent(false);
         }
 }
 
@@ -597,7 +874,12 @@ void RingmodInsertBehaviour::init_from_xml(const xmlpp::Element* nodeElement){
 	Behaviour::init_from_xml(nodeElement);
 }
 
-void RingmodInsertBehaviour::process(jack_nframes_t nframes){
+void RingmodInsertBehaviour::get_buffer_usage(AudioBufferSet& reads, AudioBufferSet& writes){
+	Behaviour::get_buffer_usage(reads, writes);
+	io_.get_buffer_usage(reads, writes);
+}
+
+void RingmodInsertBehaviour::process(jack_nframes_t offset, jack_nframes_t nframes){
 
         phasor_.set_freq(freq_);
         
@@ -605,12 +887,22 @@ void RingmodInsertBehaviour::process(jack_nframes_t nframes){
         int chans = inputs.size();
         
         float phase = phasor_.get_phase();
-        
+
+        if(gain_ == 0.0f || inputs[0]->is_silent()){
+            // the oscillator keeps running while there is nothing to modulate
+            for(int chan = 0; chan < chans; ++chan){
+                get_buffer(chan).silence(offset, nframes);
+            }
+            phasor_.advance(nframes);
+            return;
+        }
+
         for(int chan = 0; chan < chans; ++chan){
+            get_buffer(chan).set_silent(false);
             phasor_.set_phase(phase);
 
-            float* in = inputs[0]->get_buffer(); // ignore all others for now
-            float* out = get_buffer(chan).get_buffer();
+            float* in = inputs[0]->get_buffer() + offset; // ignore all others for now
+            float* out = get_buffer(chan).get_buffer() + offset;
             for(int n = 0; n < nframes; ++n){
                 float osc = sinFunction_->lookup_linear(phasor_.get_phase() * (float)SIN_TABLE_SIZE );
                 out[n] = in[n] * osc * gain_;
@@ -621,7 +913,21 @@ void RingmodInsertBehaviour::process(jack_nframes_t nframes){
 }
 
 // --------------
-LADSPABehaviour::LADSPABehaviour(){}
+LADSPABehaviour::LADSPABehaviour() :
+		descriptor_(0),
+		instance_(0),
+		active_(false)
+{}
+
+LADSPABehaviour::~LADSPABehaviour(){
+	if(instance_){
+		if(active_ && descriptor_->deactivate) descriptor_->deactivate(instance_);
+		descriptor_->cleanup(instance_);
+	}
+	for(unsigned int n = 0; n < controlPortValues_.size(); ++n){
+		delete controlPortValues_[n];
+	}
+}
 
 void LADSPABehaviour::init_from_xml(const xmlpp::Element* nodeElement){
 	std::cout << "Created LDSPA Behaviour " << std::endl; 
@@ -640,8 +946,8 @@ void LADSPABehaviour::init_from_xml(const xmlpp::Element* nodeElement){
 			std::cout << "Audio Input Port: " << descriptor_->PortNames[n] << std::endl;
 			// should tally this with the first input we find and connect
 			if (inCount < io_.get_inputs().size() ){
-				float* inBuffer = io_.get_inputs()[inCount]->get_buffer();
-				descriptor_->connect_port(instance_,n,inBuffer);
+				AudioBuffer* inBuffer = io_.get_inputs()[inCount];
+				audioPorts_.push_back(AudioPortConnection(n, inBuffer));
 				++inCount;
 			} else {
 				throw Exception("Not enough inputs specified for LADSPA plugin.");
@@ -651,7 +957,7 @@ void LADSPABehaviour::init_from_xml(const xmlpp::Element* nodeElement){
 			std::cout << "Audio Output Port: " << descriptor_->PortNames[n] << std::endl;
 			// should create an output buffer and connect
 			AudioBuffer* b = create_buffer("",id); // TODO: nasty joink here, has to force the id because the behaviour id is not yet found in base class.
-			descriptor_->connect_port(instance_,n,b->get_buffer());
+			audioPorts_.push_back(AudioPortConnection(n, b));
 			++outCount;
 		} else if(pd & LADSPA_PORT_CONTROL && pd & LADSPA_PORT_INPUT){
 			descriptor_->PortRangeHints[n];
@@ -670,12 +976,27 @@ void LADSPABehaviour::init_from_xml(const xmlpp::Element* nodeElement){
 			throw Exception("LADSPA Unusual port.");
 		}
 	}
+	connect_audio_ports(0);
 	Behaviour::init_from_xml(nodeElement);
 	// activate after fully initialised
-	descriptor_->activate(instance_);
+	if(descriptor_->activate) descriptor_->activate(instance_);
+	active_ = true;
+}
+
+void LADSPABehaviour::get_buffer_usage(AudioBufferSet& reads, AudioBufferSet& writes){
+	Behaviour::get_buffer_usage(reads, writes);
+	io_.get_buffer_usage(reads, writes);
+}
+
+void LADSPABehaviour::connect_audio_ports(jack_nframes_t offset){
+	for(unsigned int n = 0; n < audioPorts_.size(); ++n){
+		descriptor_->connect_port(instance_, audioPorts_[n].first, audioPorts_[n].second->get_buffer() + offset);
+	}
 }
 
-void LADSPABehaviour::process(jack_nframes_t nframes){
+void LADSPABehaviour::process(jack_nframes_t offset, jack_nframes_t nframes){
+	// plugins hold raw buffer pointers, sub blocks and shared buffer storage both move them
+	connect_audio_ports(offset);
 	descriptor_->run(instance_, nframes);
 }
 
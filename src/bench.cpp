@@ -0,0 +1,455 @@
+//    Resound
+//    Copyright 2009 David Moore and James Mooney
+//
+//    This file is part of Resound.
+//
+//    Resound is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    Resound is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Resound; if not, write to the Free Software
+//    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+// resoundnv-bench, times the dsp kernels and the behaviour classes on synthetic sessions
+// so a change to the hot paths can be measured in isolation from jack.
+
+#include "resoundnv/core.hpp"
+#include "resoundnv/dspstats.hpp"
+#include <time.h>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+
+#include <boost/program_options.hpp>
+
+struct BenchOptions {
+	std::vector<int> frames; ///< block sizes to time
+	int sources; ///< livestreams in the synthetic session
+	int speakers; ///< loudspeakers in the synthetic session
+	float minTime; ///< seconds each case must run for
+	std::string output; ///< csv file, empty writes to stdout
+	std::string oscPort;
+	std::string kernel; ///< buffer kernels, see dsp_select_kernels
+	bool check; ///< compare the output of the executors, kernels and mix matrix rather than timing
+};
+
+/// one thing to time, run processes a single block of nframes
+class BenchCase {
+public:
+	std::string kind;
+	std::string name;
+	int routes; ///< routes or channels touched per block, 1 for the kernels
+	BenchCase(std::string k, std::string n, int r) : kind(k), name(n), routes(r) {}
+	virtual ~BenchCase(){}
+	virtual void run(jack_nframes_t nframes) = 0;
+};
+
+// -------------------------------------------- kernels
+
+/// scratch buffers shared by the kernel cases
+struct KernelBuffers {
+	AudioBuffer src;
+	AudioBuffer dest;
+	float sink; ///< results nobody reads, keeps the compiler from dropping the work
+};
+
+class CopyWithGainCase : public BenchCase {
+	KernelBuffers& b_;
+public:
+	CopyWithGainCase(KernelBuffers& b) : BenchCase("kernel","ab_copy_with_gain",1), b_(b) {}
+	virtual void run(jack_nframes_t nframes){ ab_copy_with_gain(b_.src.get_buffer(), b_.dest.get_buffer(), nframes, 0.5f); }
+};
+
+class SumWithGainCase : public BenchCase {
+	KernelBuffers& b_;
+public:
+	SumWithGainCase(KernelBuffers& b) : BenchCase("kernel","ab_sum_with_gain",1), b_(b) {}
+	virtual void run(jack_nframes_t nframes){ ab_sum_with_gain(b_.src.get_buffer(), b_.dest.get_buffer(), nframes, 0.5f); }
+};
+
+class SumWithGainInterpCase : public BenchCase {
+	KernelBuffers& b_;
+	float gain_;
+public:
+	SumWithGainInterpCase(KernelBuffers& b) : BenchCase("kernel","ab_sum_with_gain_linear_interp",1), b_(b), gain_(0.0f) {}
+	virtual void run(jack_nframes_t nframes){
+		// alternate the target so every call ramps
+		float old = gain_;
+		gain_ = gain_ > 0.25f ? 0.0f : 0.5f;
+		ab_sum_with_gain_linear_interp(b_.src.get_buffer(), b_.dest.get_buffer(), nframes, gain_, old, 128);
+	}
+};
+
+class VUMeterCase : public BenchCase {
+	KernelBuffers& b_;
+	VUMeter meter_;
+public:
+	VUMeterCase(KernelBuffers& b) : BenchCase("kernel","VUMeter::analyse_buffer",1), b_(b) {}
+	virtual void run(jack_nframes_t nframes){
+		meter_.analyse_buffer(b_.src.get_buffer(), nframes);
+		b_.sink += meter_.get_peak();
+	}
+};
+
+class LookupLinearCase : public BenchCase {
+	KernelBuffers& b_;
+	LookupTable* table_;
+	float index_;
+public:
+	LookupLinearCase(KernelBuffers& b) : BenchCase("kernel","LookupTable::lookup_linear",1), b_(b), table_(LookupTable::create_sine(4096)), index_(0.0f) {}
+	~LookupLinearCase(){ delete table_; }
+	virtual void run(jack_nframes_t nframes){
+		// a fractional step so the interpolation is exercised, as a phasor would drive it
+		float* out = b_.dest.get_buffer();
+		for(jack_nframes_t n = 0; n < nframes; ++n){
+			out[n] = table_->lookup_linear(index_);
+			index_ += 2.37f;
+			if(index_ >= 4096.0f) index_ -= 4096.0f;
+		}
+	}
+};
+
+// -------------------------------------------- behaviours
+
+class BehaviourCase : public BenchCase {
+	Behaviour* behaviour_;
+public:
+	BehaviourCase(std::string n, int routes, Behaviour* behaviour) : BenchCase("behaviour",n,routes), behaviour_(behaviour) { assert(behaviour_); }
+	virtual void run(jack_nframes_t nframes){ behaviour_->process(0, nframes); }
+};
+
+/// a deterministic noise source so runs are comparable, each run starts from the same seed
+static void fill_noise(float* buffer, size_t N, unsigned int& seed){
+	for(size_t n = 0; n < N; ++n){
+		seed = seed * 196314165 + 907633515;
+		buffer[n] = (float)(int)seed * (1.0f / 2147483648.0f);
+	}
+}
+
+/// a session of livestreams in0.. feeding loudspeakers spk0.. through one of each behaviour class.
+/// att routes every source to every loudspeaker, mpc and chase have a routeset per source,
+/// amppan pans in0 over every loudspeaker, unless pan is false, and the inserts process every source.
+static std::string make_session_xml(int sources, int speakers, bool pan){
+	std::stringstream xml;
+	xml << "<resoundnv>\n";
+	for(int s = 0; s < sources; ++s){
+		xml << "<behaviour class=\"livestream\" id=\"in" << s << "\" port=\"none\"/>\n";
+	}
+	for(int l = 0; l < speakers; ++l){
+		float az = TWOPI * l / speakers;
+		xml << "<loudspeaker id=\"spk" << l << "\" port=\"none\" x=\"" << std::cos(az) * 4.0f << "\" y=\"" << std::sin(az) * 4.0f << "\" z=\"0\"/>\n";
+	}
+	xml << "<set id=\"out\">\n";
+	for(int l = 0; l < speakers; ++l){
+		xml << "<alias id=\"" << l << "\" ref=\"bus.spk" << l << "\"/>\n";
+	}
+	xml << "</set>\n";
+
+	xml << "<behaviour class=\"att\" id=\"att\">\n<param id=\"level\" value=\"0.5\"/>\n<routeset>\n";
+	for(int s = 0; s < sources; ++s){
+		xml << "<route from=\"in" << s << "\" to=\"out\"/>\n";
+	}
+	xml << "</routeset>\n</behaviour>\n";
+
+	const char* crossfaders[] = {"mpc", "chase"};
+	for(int c = 0; c < 2; ++c){
+		xml << "<behaviour class=\"" << crossfaders[c] << "\" id=\"" << crossfaders[c] << "\">\n";
+		xml << "<param id=\"gain\" value=\"1\"/>\n<param id=\"slope\" value=\"2\"/>\n<param id=\"position\" value=\"0.5\"/>\n";
+		for(int s = 0; s < sources; ++s){
+			xml << "<routeset><route from=\"in" << s << "\" to=\"out\"/></routeset>\n";
+		}
+		xml << "</behaviour>\n";
+	}
+
+	if(pan){
+		xml << "<behaviour class=\"amppan\" id=\"amppan\">\n<param id=\"gain\" value=\"1\"/>\n<input ref=\"in0\"/>\n";
+		for(int l = 0; l < speakers; ++l){
+			xml << "<output ref=\"spk" << l << "\"/>\n";
+		}
+		xml << "</behaviour>\n";
+	}
+
+	const char* inserts[] = {"gain", "ringmod"};
+	for(int i = 0; i < 2; ++i){
+		xml << "<behaviour class=\"" << inserts[i] << "\" id=\"" << inserts[i] << "\">\n";
+		for(int s = 0; s < sources; ++s){
+			xml << "<input ref=\"in" << s << "\"/>\n";
+		}
+		xml << "</behaviour>\n";
+	}
+	xml << "</resoundnv>\n";
+	return xml.str();
+}
+
+static double seconds_now(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/// time a case at a block size, doubling the iteration count until it runs for at least minTime
+static void measure(BenchCase& c, jack_nframes_t nframes, float minTime, std::ostream& out){
+	c.run(nframes); // warm the caches and any lazily allocated state
+	unsigned long iterations = 1;
+	for(;;){
+		double start = seconds_now();
+		dsp_cycles_t cycles = dsp_read_cycles();
+		for(unsigned long n = 0; n < iterations; ++n){
+			c.run(nframes);
+		}
+		cycles = dsp_read_cycles() - cycles;
+		double elapsed = seconds_now() - start;
+		if(elapsed >= minTime || iterations >= (1UL << 30)){
+			double samples = (double)iterations * nframes;
+			out << g_dspKernels.name << "," << c.kind << "," << c.name << "," << nframes << "," << c.routes << "," << iterations << ","
+				<< elapsed * 1e9 / samples << "," << cycles / samples << "\n";
+			return;
+		}
+		iterations *= 2;
+	}
+}
+
+// -------------------------------------------- equivalence check
+
+/// one way of running the synthetic session
+struct CheckRun {
+	const char* executor;
+	const char* kernel; ///< null for the kernels given on the command line
+	bool mixMatrix;
+};
+
+/// blocks rendered per run, long enough for every route to ramp in and settle
+static const int CHECK_BLOCKS = 64;
+
+/// render the synthetic session a block of nframes at a time with the same noise on every livestream,
+/// out gets every loudspeaker of every block one after the other
+static void render_check(const BenchOptions& options, const CheckRun& run, bool pan, jack_nframes_t nframes, std::vector<float>& out){
+	CLIOptions sessionOptions;
+	sessionOptions.oscPort_ = options.oscPort;
+	sessionOptions.executor_ = run.executor;
+	sessionOptions.kernel_ = run.kernel ? run.kernel : options.kernel;
+	sessionOptions.mixMatrix_ = run.mixMatrix;
+	sessionOptions.offline_ = true;
+	sessionOptions.renderBufferSize_ = nframes;
+
+	std::streambuf* coutBuffer = std::cout.rdbuf(0);
+	ResoundSession* session = new ResoundSession(sessionOptions);
+	APP().set_session(session);
+	xmlpp::DomParser parser;
+	parser.set_validate(false);
+	parser.parse_memory(make_session_xml(options.sources, options.speakers, pan));
+	session->load_from_xml(parser.get_document()->get_root_node());
+
+	const std::vector<Loudspeaker*>& loudspeakers = session->get_loudspeakers();
+	unsigned int seed = 22222;
+	out.clear();
+	out.reserve((size_t)CHECK_BLOCKS * loudspeakers.size() * nframes);
+	for(int b = 0; b < CHECK_BLOCKS; ++b){
+		for(int s = 0; s < options.sources; ++s){
+			std::stringstream id;
+			id << "in" << s;
+			fill_noise(session->get_port(id.str())->get_audio_buffer(nframes), nframes, seed);
+		}
+		session->process_offline();
+		for(unsigned int l = 0; l < loudspeakers.size(); ++l){
+			const float* buffer = loudspeakers[l]->get_port()->get_audio_buffer(nframes);
+			out.insert(out.end(), buffer, buffer + nframes);
+		}
+	}
+	delete session;
+	std::cout.rdbuf(coutBuffer);
+	std::cout.clear();
+}
+
+static std::string describe_run(const BenchOptions& options, const CheckRun& run){
+	std::stringstream s;
+	s << run.executor << " " << (run.kernel ? run.kernel : options.kernel.c_str()) << (run.mixMatrix ? " matrix" : " per-route");
+	return s.str();
+}
+
+/// render the session serially and in parallel, with the scalar kernels and the selected ones,
+/// with and without the mix matrix, and compare the loudspeakers to the bit. returns the number that differ
+static int run_checks(const BenchOptions& options){
+	// reference first, then the runs that must match it. the matrix sums its routes after amppan
+	// has written the buses where route by route they come first, so that pair leaves amppan out
+	static const struct {
+		bool pan;
+		CheckRun reference;
+		CheckRun run;
+	} checks[] = {
+		{ true, { "serial", "scalar", true }, { "parallel", "scalar", true } },
+		{ true, { "serial", "scalar", true }, { "serial", 0, true } },
+		{ true, { "serial", "scalar", true }, { "parallel", 0, true } },
+		{ false, { "serial", "scalar", false }, { "serial", "scalar", true } },
+		{ false, { "serial", "scalar", false }, { "parallel", 0, true } },
+	};
+	int failures = 0;
+	std::vector<float> expected, actual;
+	for(unsigned int f = 0; f < options.frames.size(); ++f){
+		jack_nframes_t nframes = options.frames[f];
+		for(unsigned int c = 0; c < sizeof(checks) / sizeof(checks[0]); ++c){
+			render_check(options, checks[c].reference, checks[c].pan, nframes, expected);
+			render_check(options, checks[c].run, checks[c].pan, nframes, actual);
+			std::cout << nframes << " frames" << (checks[c].pan ? "" : " without amppan") << ", "
+				<< describe_run(options, checks[c].reference) << " against " << describe_run(options, checks[c].run) << ": ";
+			if(expected.size() == actual.size() && std::memcmp(&expected[0], &actual[0], expected.size() * sizeof(float)) == 0){
+				std::cout << "identical\n";
+				continue;
+			}
+			++failures;
+			size_t n = 0;
+			while(n < expected.size() && n < actual.size() && std::memcmp(&expected[n], &actual[n], sizeof(float)) == 0) ++n;
+			if(n < expected.size() && n < actual.size()){
+				size_t frame = n % nframes, speaker = n / nframes % options.speakers, block = n / nframes / options.speakers;
+				std::cout << "DIFFERS at block " << block << " loudspeaker spk" << speaker << " frame " << frame
+					<< ", " << expected[n] << " against " << actual[n] << "\n";
+			} else {
+				std::cout << "DIFFERS in length, " << expected.size() << " against " << actual.size() << " samples\n";
+			}
+		}
+	}
+	return failures;
+}
+
+static void parse_command_arguments(int argc, char** argv, BenchOptions& options){
+	namespace po = boost::program_options;
+
+	po::options_description desc("Usage: resoundnv-bench");
+	desc.add_options()
+		("help", "Display this help message.")
+		("frames", po::value<std::vector<int> >(&options.frames)->multitoken(), "Block sizes to time, defaults to every power of two from 32 to 4096")
+		("sources", po::value<int>(&options.sources)->default_value(8), "Livestreams in the synthetic session")
+		("speakers", po::value<int>(&options.speakers)->default_value(8), "Loudspeakers in the synthetic session")
+		("min-time", po::value<float>(&options.minTime)->default_value(0.2f), "Seconds each case is run for at least")
+		("output", po::value<std::string>(&options.output)->default_value(""), "Write the csv results to this file instead of stdout")
+		("kernel", po::value<std::string>(&options.kernel)->default_value("auto"), "Buffer kernels to time, auto, avx512, avx2, sse2 or scalar")
+		("port", po::value<std::string>(&options.oscPort)->default_value("18000"), "OSC listening port of the synthetic session")
+		("check", "Check the executors, kernels and mix matrix give the same output to the bit rather than timing them")
+	;
+
+	po::variables_map vm;
+	po::store(po::parse_command_line(argc, argv, desc), vm);
+	po::notify(vm);
+
+	if (vm.count("help")) {
+		std::cout << desc << "\n";
+		exit(1);
+	}
+	options.check = vm.count("check") > 0;
+	if(options.frames.empty()){
+		for(int n = 32; n <= 4096; n *= 2) options.frames.push_back(n);
+	}
+	if(options.sources < 1 || options.speakers < 1){
+		std::cout << "Cannot continue, at least one source and one speaker are needed.\n";
+		exit(1);
+	}
+}
+
+int main(int argc, char** argv){
+	BenchOptions options;
+	parse_command_arguments(argc, argv, options);
+
+	int maxFrames = 0;
+	for(unsigned int n = 0; n < options.frames.size(); ++n){
+		if(options.frames[n] < 1){
+			std::cout << "Cannot continue, block sizes must be positive.\n";
+			return 1;
+		}
+		maxFrames = options.frames[n] > maxFrames ? options.frames[n] : maxFrames;
+	}
+
+	if(!dsp_select_kernels(options.kernel)){
+		std::cout << "Cannot continue, unknown kernel or not supported by this cpu.\n";
+		return 1;
+	}
+	if(options.check){
+		return run_checks(options) == 0 ? 0 : 1;
+	}
+
+	// an offline session with a block big enough for every size timed
+	CLIOptions sessionOptions;
+	sessionOptions.oscPort_ = options.oscPort;
+	sessionOptions.kernel_ = options.kernel;
+	sessionOptions.offline_ = true;
+	sessionOptions.renderBufferSize_ = maxFrames;
+
+	// the session reports everything it builds, keep that out of the results
+	std::streambuf* coutBuffer = std::cout.rdbuf(0);
+	ResoundSession* session = new ResoundSession(sessionOptions);
+	APP().set_session(session);
+	xmlpp::DomParser parser;
+	parser.set_validate(false);
+	parser.parse_memory(make_session_xml(options.sources, options.speakers, true));
+	session->load_from_xml(parser.get_document()->get_root_node());
+	std::cout.rdbuf(coutBuffer);
+	std::cout.clear();
+
+	// noise on every livestream, one pass through the whole session fills every buffer downstream
+	unsigned int seed = 22222;
+	for(int s = 0; s < options.sources; ++s){
+		std::stringstream id;
+		id << "in" << s;
+		fill_noise(session->get_port(id.str())->get_audio_buffer(maxFrames), maxFrames, seed);
+	}
+	session->process_offline();
+
+	KernelBuffers kernelBuffers;
+	kernelBuffers.src.allocate(maxFrames);
+	kernelBuffers.dest.allocate(maxFrames);
+	kernelBuffers.sink = 0.0f;
+	fill_noise(kernelBuffers.src.get_buffer(), maxFrames, seed);
+	kernelBuffers.dest.clear();
+
+	std::vector<BenchCase*> cases;
+	cases.push_back(new CopyWithGainCase(kernelBuffers));
+	cases.push_back(new SumWithGainCase(kernelBuffers));
+	cases.push_back(new SumWithGainInterpCase(kernelBuffers));
+	cases.push_back(new VUMeterCase(kernelBuffers));
+	cases.push_back(new LookupLinearCase(kernelBuffers));
+	int S = options.sources, L = options.speakers;
+	const char* behaviours[] = {"att", "mpc", "chase", "amppan", "gain", "ringmod"};
+	int routes[] = {S * L, S * L, S * L, L, S, S};
+	for(int b = 0; b < 6; ++b){
+		Behaviour* behaviour = dynamic_cast<Behaviour*>(session->get_dynamic_object(behaviours[b]));
+		cases.push_back(new BehaviourCase(behaviours[b], routes[b], behaviour));
+	}
+	// the routes of att, mpc and chase summed in one pass, compare with the sum of those three
+	MixMatrix::BehaviourVector routeSetBehaviours;
+	for(int b = 0; b < 3; ++b){
+		routeSetBehaviours.push_back(dynamic_cast<Behaviour*>(session->get_dynamic_object(behaviours[b])));
+	}
+	MixMatrix matrix(routeSetBehaviours);
+	cases.push_back(new BehaviourCase("mixmatrix", matrix.get_route_count(), &matrix));
+
+	std::ofstream file;
+	if(options.output != ""){
+		file.open(options.output.c_str());
+		if(!file){
+			std::cout << "Cannot write to " << options.output << "\n";
+			return 1;
+		}
+	}
+	std::ostream& out = options.output != "" ? file : std::cout;
+
+	// cycles are timestamp counter ticks on x86, nanoseconds elsewhere
+	out << "kernel,kind,name,frames,routes,iterations,ns_per_sample,cycles_per_sample\n";
+	for(unsigned int c = 0; c < cases.size(); ++c){
+		for(unsigned int f = 0; f < options.frames.size(); ++f){
+			measure(*cases[c], options.frames[f], options.minTime, out);
+			out.flush();
+		}
+	}
+
+	for(unsigned int c = 0; c < cases.size(); ++c){
+		delete cases[c];
+	}
+	delete session;
+	return 0;
+}
@@ -0,0 +1,119 @@
+//    Resound
+//    Copyright 2009 David Moore and James Mooney
+//
+//    This file is part of Resound.
+//
+//    Resound is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    Resound is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Resound; if not, write to the Free Software
+//    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include "resoundnv/bufferarena.hpp"
+#include <sys/mman.h>
+#include <cstring>
+#include <iostream>
+#include <new>
+
+BufferArena::BufferArena(size_t slabSize, bool hugePages) :
+		slabSize_(slabSize),
+		hugePages_(hugePages),
+		locked_(true),
+		buffers_(0)
+{
+	if(hugePages_){
+		slabSize_ = (slabSize_ + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+	}
+}
+
+BufferArena::~BufferArena(){
+	for(unsigned int n = 0; n < slabs_.size(); ++n){
+		munlock(slabs_[n].base, slabs_[n].size);
+		munmap(slabs_[n].base, slabs_[n].size);
+	}
+}
+
+float* BufferArena::allocate(size_t frames){
+	size_t bytes = (frames * sizeof(float) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+	if(bytes == 0) bytes = ALIGNMENT;
+	++buffers_;
+
+	FreeMap::iterator it = free_.find(bytes);
+	if(it != free_.end() && !it->second.empty()){
+		float* buffer = it->second.back();
+		it->second.pop_back();
+		std::memset(buffer, 0, bytes);
+		return buffer;
+	}
+
+	if(slabs_.empty() || slabs_.back().size - slabs_.back().used < bytes){
+		add_slab(bytes > slabSize_ ? bytes : slabSize_);
+	}
+	Slab& slab = slabs_.back();
+	float* buffer = (float*)(slab.base + slab.used);
+	slab.used += bytes;
+	// slabs are zeroed when prefaulted
+	return buffer;
+}
+
+void BufferArena::release(float* buffer, size_t frames){
+	if(!buffer) return;
+	size_t bytes = (frames * sizeof(float) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+	if(bytes == 0) bytes = ALIGNMENT;
+	free_[bytes].push_back(buffer);
+	--buffers_;
+}
+
+void BufferArena::add_slab(size_t bytes){
+	Slab slab;
+	slab.size = bytes;
+	slab.used = 0;
+	void* p = MAP_FAILED;
+	bool wantHuge = hugePages_;
+#ifdef MAP_HUGETLB
+	if(hugePages_){
+		size_t huge = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+		p = mmap(0, huge, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if(p != MAP_FAILED){
+			slab.size = huge;
+		} else {
+			std::cout << "BufferArena no hugepages available, using normal pages" << std::endl;
+			hugePages_ = false;
+		}
+	}
+#endif
+	if(p == MAP_FAILED){
+		p = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(p == MAP_FAILED) throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+		// transparent hugepages are the next best thing
+		if(wantHuge) madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+	}
+	slab.base = (char*)p;
+	// touch every page now rather than on the dsp thread, then keep them in ram
+	std::memset(slab.base, 0, slab.size);
+	if(mlock(slab.base, slab.size) != 0){
+		if(locked_) std::cout << "BufferArena could not lock buffers into memory, check ulimit -l" << std::endl;
+		locked_ = false;
+	}
+	slabs_.push_back(slab);
+}
+
+void BufferArena::print(){
+	size_t size = 0, used = 0;
+	for(unsigned int n = 0; n < slabs_.size(); ++n){
+		size += slabs_[n].size;
+		used += slabs_[n].used;
+	}
+	std::cout << "BufferArena " << buffers_ << " buffers, " << used / 1024 << "k used of " << slabs_.size()
+		<< " slabs totalling " << size / 1024 << "k" << (hugePages_ ? ", hugepages" : "") << (locked_ ? ", locked" : "") << std::endl;
+}
@@ -19,11 +19,14 @@
 
 #include "resoundnv/core.hpp"
 #include <typeinfo>
+#include <unistd.h>
 #include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <algorithm>
 
 #include <cmath>
 
-#include <boost/program_options.hpp>
 
 
 
@@ -59,7 +62,7 @@ void Loudspeaker::init_from_xml(const xmlpp::Element* nodeElement){
 
 	ObjectId id = get_attribute_string(nodeElement,"id");
 	connectionName_ = get_attribute_string(nodeElement,"port");
-	port_ = new JackPort(id, JackPortIsOutput ,&SESSION());
+	port_ = SESSION().create_port(id, JackPortIsOutput);
 	port_->connect(connectionName_);
 
 	type_ = get_optional_attribute_string(nodeElement,"type");
@@ -70,11 +73,12 @@ void Loudspeaker::init_from_xml(const xmlpp::Element* nodeElement){
 	el_ = get_optional_attribute_float(nodeElement,"el");
 	
 	gain_ = get_optional_attribute_float(nodeElement,"gain",1.0);
+	direct_ = !SESSION().get_options().copyOut_;
 
 	std::cout << "Loudspeaker " << id << " type=" << type_ << std::endl;
 
 	jack_nframes_t s = SESSION().get_buffer_size();
-	buffer_.allocate(s);
+	buffer_.allocate(s, &SESSION().get_buffer_arena());
 
         // register the buffer
         BufferRef ref;
@@ -93,8 +97,16 @@ void Loudspeaker::init_from_xml(const xmlpp::Element* nodeElement){
 
 void Loudspeaker::pre_process(jack_nframes_t nframes){
 	// class is expected to make its next buffer of audio ready to be written too.
+	// direct, the behaviours sum straight into this blocks port buffer.
 	// clear buffer ready for summing.
-	buffer_.clear();
+	if(direct_){
+		buffer_.alias(port_->get_audio_buffer(nframes));
+		buffer_.clear(nframes);
+	} else {
+		buffer_.clear();
+	}
+	// whatever sums into the bus clears this
+	buffer_.set_silent(true);
 	//std::cout << "Loudspeaker::pre_process" << std::endl;
 }
 
@@ -104,11 +116,19 @@ void Loudspeaker::post_process(jack_nframes_t nframes){
 
 	//avg_signal_in_buffer(buffer_.get_buffer(),nframes); // tested // no sound here
 
-	ab_copy_with_gain(buffer_.get_buffer(), port_->get_audio_buffer(nframes), nframes, gain_);
-	//std::cout << "Loudspeaker::post_process" << std::endl;
+	// the program meter bank has already metered the bus
+	if(buffer_.is_silent()){
+		if(!direct_) std::memset(port_->get_audio_buffer(nframes), 0, sizeof(float) * nframes);
+		return;
+	}
 
-	//TODO optional vumetering
-	vuMeter_.analyse_buffer(buffer_.get_buffer(),nframes);
+	if(direct_){
+		// the bus already is the port buffer, the gain is applied in place and only when there is one
+		if(gain_ != 1.0f) ab_copy_with_gain(buffer_.get_buffer(), buffer_.get_buffer(), nframes, gain_);
+	} else {
+		ab_copy_with_gain(buffer_.get_buffer(), port_->get_audio_buffer(nframes), nframes, gain_);
+	}
+	//std::cout << "Loudspeaker::post_process" << std::endl;
 }
 
 Alias::Alias(const xmlpp::Node* node, ObjectId parent){
@@ -172,14 +192,37 @@ Alias* AliasSet::get_alias(ObjectId id){
 
 ResoundSession::ResoundSession(CLIOptions options) : 
 		Resound::OSCManager(options.oscPort_.c_str()),
-		options_(options) {
+		options_(options),
+		program_(0),
+		pendingProgram_(0),
+		purgeRetiredParams_(false),
+		blockCount_(0),
+		reloadRequested_(false),
+		feedbackTicks_(0),
+		programGeneration_(0),
+		meterGeneration_(0),
+		dspPool_(0),
+		paramQueue_(options.paramQueueSize_),
+		timedParamQueue_(options.timedQueueSize_),
+		bufferArena_(BufferArena::HUGE_PAGE_SIZE, options.hugePages_) {
 
 	// setup ladspa hosting
 	ladspaHost = new LadspaHost();
 
 	// diskstream threads
+	diskstreamThreadStarted_ = false;
+	diskReadHolds_ = 0;
 	pthread_mutex_init (&diskstreamThreadLock_, NULL);
-	pthread_cond_init(&diskstreamThreadReady_, NULL);
+	pthread_cond_init(&diskReadDone_, NULL);
+	pthread_mutex_init (&programLock_, NULL);
+	pthread_mutex_init (&meterLock_, NULL);
+	sem_init(&diskstreamWake_, 0, 0);
+
+	// the widest buffer kernels this cpu can run, unless asked for others
+	if(!dsp_select_kernels(options_.kernel_)){
+		throw Exception("Unknown kernel or not supported by this cpu, use auto, avx512, avx2, sse2 or scalar.");
+	}
+	std::cout << "Using " << g_dspKernels.name << " dsp kernels" << std::endl;
 
 	// registering some factories
         register_behaviour_factory("diskstream", Diskstream::factory);
@@ -192,7 +235,20 @@ ResoundSession::ResoundSession(CLIOptions options) :
         register_behaviour_factory("ringmod", RingmodInsertBehaviour::factory);
         register_behaviour_factory("ladspa", LADSPABehaviour::factory);
 
-	init("resoundnv-session");
+	if(options_.offline_){
+		init_offline("resoundnv-session", options_.renderBufferSize_, options_.renderSampleRate_);
+	} else {
+		init("resoundnv-session");
+	}
+
+	// worker threads for the parallel executor
+	if(options_.executor_ == "parallel"){
+		int threads = options_.dspThreads_;
+		if(threads <= 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+		dspPool_ = new DspWorkerPool(this, threads);
+	} else if(options_.executor_ != "serial"){
+		throw Exception("Unknown executor, use serial or parallel.");
+	}
 
 	///activate jack ports cannot be connected until active
 	start();
@@ -201,6 +257,20 @@ ResoundSession::ResoundSession(CLIOptions options) :
 	add_method("/resound/t1/play","i", ResoundSession::lo_play, this);
 	add_method("/resound/t1/stop","i", ResoundSession::lo_stop, this);
 	add_method("/resound/t1/seek","i", ResoundSession::lo_seek, this);
+
+	// diagnostics
+	add_method("/resound/paramqueue","", ResoundSession::lo_param_queue_stats, this);
+	add_method("/resound/timedqueue","", ResoundSession::lo_timed_queue_stats, this);
+	add_method("/resound/diskstreams","", ResoundSession::lo_diskstream_stats, this);
+
+	// reload the input xml in place
+	add_method("/resound/reload","", ResoundSession::lo_reload, this);
+
+	// dsp timings per object
+	add_method("/resound/stats","", ResoundSession::lo_stats, this);
+
+	// which meters a client wants and how often, any types so the meter names can follow the rate
+	add_method("/resound/meters/subscribe", ResoundSession::lo_meters_subscribe, this);
 }
 
 int ResoundSession::lo_play(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data){
@@ -222,23 +292,149 @@ int ResoundSession::lo_seek(const char *path, const char *types, lo_arg **argv,
     return 1;
 }
 
+int ResoundSession::lo_diskstream_stats(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data){
+	ResoundSession* session = static_cast<ResoundSession*>(user_data);
+	float rate = (float)session->get_sample_rate();
+	// reply with id, seconds buffered, the fewest seconds buffered since play or seek and underruns for each stream
+	lo_message reply = lo_message_new();
+	pthread_mutex_lock(&session->diskstreamThreadLock_);
+	for(unsigned int n = 0; n < session->diskStreams_.size(); ++n){
+		Diskstream* stream = session->diskStreams_[n];
+		lo_message_add_string(reply, stream->get_id().c_str());
+		lo_message_add_float(reply, stream->get_buffered_frames() / rate);
+		lo_message_add_float(reply, stream->get_low_water() / rate);
+		lo_message_add_int32(reply, (int)stream->get_underruns());
+	}
+	pthread_mutex_unlock(&session->diskstreamThreadLock_);
+	lo_send_message(lo_message_get_source(data), "/resound/diskstreams", reply);
+	lo_message_free(reply);
+    return 1;
+}
+
+int ResoundSession::lo_param_queue_stats(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data){
+	ResoundSession* session = static_cast<ResoundSession*>(user_data);
+	const ParamQueue& q = session->paramQueue_;
+	// reply with depth, high water mark, capacity, posted, collapsed and dropped counts
+	lo_send(lo_message_get_source(data), "/resound/paramqueue", "iiiiii",
+		(int)q.get_depth(), (int)q.get_high_water(), (int)q.get_capacity(),
+		(int)q.get_posted(), (int)q.get_collapsed(), (int)q.get_dropped());
+    return 1;
+}
+
+int ResoundSession::lo_timed_queue_stats(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data){
+	ResoundSession* session = static_cast<ResoundSession*>(user_data);
+	const TimedParamQueue& q = session->timedParamQueue_;
+	// reply with pending, posted, dropped, late and overflowed counts
+	lo_send(lo_message_get_source(data), "/resound/timedqueue", "iiiii",
+		(int)q.get_pending(), (int)q.get_posted(), (int)q.get_dropped(),
+		(int)q.get_late(), (int)q.get_overflowed());
+    return 1;
+}
+
+int ResoundSession::lo_reload(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data){
+	ResoundSession* session = static_cast<ResoundSession*>(user_data);
+	// the reload is done by the main thread so osc keeps flowing meanwhile
+	session->request_reload();
+	std::cout << "Reload requested\n";
+    return 1;
+}
+
+int ResoundSession::lo_meters_subscribe(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data){
+	ResoundSession* session = static_cast<ResoundSession*>(user_data);
+	// a rate in updates per second then the meter addresses wanted, none for every meter. a rate of 0 unsubscribes
+	if(argc < 1 || (types[0] != 'f' && types[0] != 'i')){
+		std::cout << "usage: /resound/meters/subscribe rate [meter ...]\n";
+		return 1;
+	}
+	float rate = types[0] == 'f' ? argv[0]->f : (float)argv[0]->i;
+	MeterSubscription s;
+	if(rate <= 0.0f){
+		s.divisor = 0;
+	} else {
+		// ticks are the finest rate there is, anything faster gets every tick
+		float ticks = session->options_.meterRate_ / rate + 0.5f;
+		s.divisor = ticks < 1.0f ? 1 : (unsigned int)ticks;
+	}
+	for(int n = 1; n < argc; ++n){
+		if(types[n] != 's') continue;
+		std::string name(&argv[n]->s);
+		if(name.empty() || name[0] != '/') name = "/" + name;
+		s.names.insert(name);
+	}
+	char* sourceUrl = lo_address_get_url(lo_message_get_source(data));
+	std::string url(sourceUrl);
+	std::free(sourceUrl);
+	pthread_mutex_lock(&session->meterLock_);
+	session->meterSubscriptions_[url] = s;
+	pthread_mutex_unlock(&session->meterLock_);
+	return 1;
+}
+
+int ResoundSession::lo_stats(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data){
+	ResoundSession* session = static_cast<ResoundSession*>(user_data);
+	lo_address source = lo_message_get_source(data);
+#ifdef RESOUND_DSP_STATS
+	std::vector<DspTimerSummary> summaries;
+	pthread_mutex_lock(&session->programLock_);
+	if(session->program_) session->program_->get_stats().summarise(summaries);
+	pthread_mutex_unlock(&session->programLock_);
+	// the time available per block, then min, mean, max and 99th percentile per object, all in microseconds
+	float budget = 1000000.0f * session->get_buffer_size() / session->get_sample_rate();
+	lo_send(source, "/resound/stats/budget", "f", budget);
+	for(unsigned int n = 0; n < summaries.size(); ++n){
+		const DspTimerSummary& s = summaries[n];
+		lo_send(source, "/resound/stats", "sffffi", s.name.c_str(), s.min, s.mean, s.max, s.p99, (int)s.blocks);
+	}
+#else
+	lo_send(source, "/resound/stats/disabled", "");
+#endif
+    return 1;
+}
+
+jack_nframes_t ResoundSession::timetag_to_frame(lo_timetag when){
+	lo_timetag now;
+	lo_timetag_now(&now);
+	jack_nframes_t frame = get_frame_time();
+	double seconds = lo_timetag_diff(when, now);
+	return frame + (jack_nframes_t)(int)std::floor(seconds * get_sample_rate() + 0.5);
+}
+
+void ResoundSession::schedule_parameter(BParam* param, float value, lo_timetag when){
+	timedParamQueue_.post(param, value, timetag_to_frame(when));
+}
+
 /// diskstream play
 void ResoundSession::diskstream_play(){
+	// a reload may be swapping the diskstreams over
+	pthread_mutex_lock(&diskstreamThreadLock_);
+	hold_disk_reads();
 	for(unsigned int n = 0; n < diskStreams_.size(); ++n){
 		diskStreams_[n]->play();
 	}
+	release_disk_reads();
+	pthread_mutex_unlock(&diskstreamThreadLock_);
 }
 /// diskstream stop
 void ResoundSession::diskstream_stop(){
+	// a reload may be swapping the diskstreams over
+	pthread_mutex_lock(&diskstreamThreadLock_);
+	hold_disk_reads();
 	for(unsigned int n = 0; n < diskStreams_.size(); ++n){
 		diskStreams_[n]->stop();
 	}
+	release_disk_reads();
+	pthread_mutex_unlock(&diskstreamThreadLock_);
 }
 /// diskstream seek
 void ResoundSession::diskstream_seek(size_t pos){
+	// a reload may be swapping the diskstreams over
+	pthread_mutex_lock(&diskstreamThreadLock_);
+	hold_disk_reads();
 	for(unsigned int n = 0; n < diskStreams_.size(); ++n){
 		diskStreams_[n]->seek(pos);
 	}
+	release_disk_reads();
+	pthread_mutex_unlock(&diskstreamThreadLock_);
 }
 
 
@@ -248,21 +444,67 @@ ResoundSession::~ResoundSession(){
     printf("Signalling diskstream thread...\n");
     if (pthread_mutex_lock (&diskstreamThreadLock_) == 0) {
             diskstreamThreadContinue_ = false;
-            pthread_cond_signal (&diskstreamThreadReady_);
             pthread_mutex_unlock (&diskstreamThreadLock_);
     }
-    pthread_join(diskstreamThreadId_,0);
+    for(unsigned int n = 0; n < diskstreamThreads_.size(); ++n){
+            sem_post(&diskstreamWake_);
+    }
+    for(unsigned int n = 0; n < diskstreamThreads_.size(); ++n){
+            pthread_join(diskstreamThreads_[n],0);
+    }
+    sem_destroy(&diskstreamWake_);
+    pthread_cond_destroy(&diskReadDone_);
     printf("Signalling Jack...\n");
     stop(); // stop the jack thread
+    delete program_;
+    delete dspPool_;
+    for(unsigned int n = 0; n < meterMessages_.size(); ++n){
+        lo_message_free(meterMessages_[n]);
+    }
+    printf("Parameter queue: high water %u of %u, %u posted, %u collapsed, %u dropped\n",
+        paramQueue_.get_high_water(), (unsigned int)paramQueue_.get_capacity(),
+        paramQueue_.get_posted(), paramQueue_.get_collapsed(), paramQueue_.get_dropped());
+    for(unsigned int n = 0; n < diskStreams_.size(); ++n){
+        printf("Diskstream %s: fewest %u of %u frames buffered, %u underruns\n", diskStreams_[n]->get_id().c_str(),
+            (unsigned int)diskStreams_[n]->get_low_water(), (unsigned int)diskStreams_[n]->get_read_ahead(), diskStreams_[n]->get_underruns());
+    }
     // TODO stop the diskthread here
     printf("Done\n");
 }
 
 void ResoundSession::load_from_xml(const xmlpp::Node* node){
 	// throw if we get problems here
-	const xmlpp::Element* nodeElement = dynamic_cast<const xmlpp::Element*>(node);
-	if(nodeElement)
-	{	
+	const xmlpp::Element* nodeElement = get_element(node);
+
+	// put the running session to one side, it keeps running until the new one is complete
+	DynamicObjectMap oldObjects;
+	DynamicObjectVector oldOrder;
+	BufferRefMap oldBuffers;
+	SignatureMap oldSignatures;
+	DependencyMap oldDependencies;
+	oldObjects.swap(dynamicObjects_);
+	oldOrder.swap(dynamicObjectOrder_);
+	oldBuffers.swap(buffers_);
+	oldSignatures.swap(signatures_);
+	oldDependencies.swap(dependencies_);
+	claimedPorts_.clear();
+	adoptedPorts_.clear();
+	loadedParams_.clear();
+
+	// the buffers each old object created, carried over with it
+	typedef std::multimap<ObjectId,BufferRef> CreatorBufferMap;
+	CreatorBufferMap oldBuffersByCreator;
+	for(BufferRefMap::iterator it = oldBuffers.begin(); it != oldBuffers.end(); ++it){
+		oldBuffersByCreator.insert(std::make_pair(it->second.creator, it->second));
+	}
+
+	std::set<DynamicObject*> reused;
+	DynamicObjectVector created;
+	std::vector<ObjectId> createdPorts;
+	DspProgram* program = 0;
+	LoudspeakerVector loudspeakers;
+	DiskstreamVector diskstreams;
+	try {
 		// The construction relies on the xml being ordered correctly
                 // you can't refer to objects that have not yet been defined.
 		xmlpp::Node::NodeList nodes;
@@ -273,26 +515,261 @@ void ResoundSession::load_from_xml(const xmlpp::Node* node){
 			const xmlpp::Element* child = dynamic_cast<const xmlpp::Element*>(*it);
 			if(child){
 				std::string name = child->get_name();
-				DynamicObject* p=0;
-				if(name=="loudspeaker"){
-					p = new Loudspeaker();
-				} else if(name=="set"){
-					p = new AliasSet();
-				} else if(name=="behaviour"){
-					p = create_behaviour_from_node(child);
+				if(name!="loudspeaker" && name!="set" && name!="behaviour") continue;
+
+				ObjectId id = get_attribute_string(child,"id");
+				std::string signature = get_element_signature(child);
+
+				// an object whose xml and dependencies are unchanged is carried over as it is
+				DynamicObjectMap::iterator old = oldObjects.find(id);
+				if(old != oldObjects.end() && oldSignatures[id] == signature &&
+						can_reuse(old->second, oldDependencies[id], oldObjects)){
+					register_dynamic_object(id, old->second);
+					std::pair<CreatorBufferMap::iterator, CreatorBufferMap::iterator> range = oldBuffersByCreator.equal_range(id);
+					for(CreatorBufferMap::iterator b = range.first; b != range.second; ++b){
+						register_buffer(b->second);
+					}
+					dependencies_[id] = oldDependencies[id];
+					if(ports_.count(id)) claimedPorts_.insert(id);
+					reused.insert(old->second);
+				} else {
+					DynamicObject* p=0;
+					if(name=="loudspeaker"){
+						p = new Loudspeaker();
+					} else if(name=="set"){
+						p = new AliasSet();
+					} else if(name=="behaviour"){
+						p = create_behaviour_from_node(child);
+					}
+					// counted as built before init, so one that throws part way is destroyed with the rest
+					created.push_back(p);
+					if(!ports_.count(id)) createdPorts.push_back(id);
+					loadingId_ = id;
+					dependencies_[id];
+					p->init_from_xml(child);
+					loadingId_ = "";
 				}
-                               
-				if(p) p->init_from_xml(child);
+				signatures_[id] = signature;
+			}
+		}
+
+		// now loaded so sort out the fast lookup object tables
+		program = build_dsp_object_lookups(loudspeakers, diskstreams);
+	} catch(...) {
+		// back out everything built so far, the running session never saw any of it
+		loadingId_ = "";
+		for(unsigned int n = 0; n < created.size(); ++n){
+			delete created[n];
+		}
+		for(unsigned int n = 0; n < createdPorts.size(); ++n){
+			// not every object makes a port
+			JackPortMap::iterator port = ports_.find(createdPorts[n]);
+			if(port == ports_.end()) continue;
+			delete port->second;
+			ports_.erase(port);
+		}
+		for(unsigned int n = 0; n < adoptedPorts_.size(); ++n){
+			JackPort* port = adoptedPorts_[n].first;
+			port->disconnect_all();
+			const JackPortNameList& connections = adoptedPorts_[n].second;
+			for(JackPortNameList::const_iterator c = connections.begin(); c != connections.end(); ++c){
+				port->connect(*c);
+			}
+		}
+		dynamicObjects_.swap(oldObjects);
+		dynamicObjectOrder_.swap(oldOrder);
+		buffers_.swap(oldBuffers);
+		signatures_.swap(oldSignatures);
+		dependencies_.swap(oldDependencies);
+		loadedParams_.clear();
+		throw;
+	}
+
+	// the objects left behind are retired, their parameters must stop receiving osc first
+	DynamicObjectVector retired;
+	retiredParams_.clear();
+	for(unsigned int n = 0; n < oldOrder.size(); ++n){
+		if(reused.count(oldOrder[n])) continue;
+		retired.push_back(oldOrder[n]);
+		Behaviour* behaviour = dynamic_cast<Behaviour*>(oldOrder[n]);
+		if(!behaviour) continue;
+		const Behaviour::BParamMap& params = behaviour->get_parameters();
+		for(Behaviour::BParamMap::const_iterator it = params.begin(); it != params.end(); ++it){
+			if(it->second->get_address() != "") remove_target(it->second->get_address(), it->second);
+			retiredParams_.insert(it->second);
+		}
+	}
+	publish_targets();
+
+	// the disk threads walk the diskstreams, swap them over once no read is in flight
+	pthread_mutex_lock(&diskstreamThreadLock_);
+	hold_disk_reads();
+	diskStreams_.swap(diskstreams);
+	release_disk_reads();
+	pthread_mutex_unlock(&diskstreamThreadLock_);
+	loudspeakers_.swap(loudspeakers);
+
+	DspProgram* oldProgram = program_;
+	purgeRetiredParams_ = true;
+	swap_program(program);
+
+	// the new parameters go live now the graph they belong to is running
+	for(unsigned int n = 0; n < loadedParams_.size(); ++n){
+		add_target(loadedParams_[n]->get_address(), BParam::lo_cb_params, loadedParams_[n]);
+	}
+	publish_targets();
+	loadedParams_.clear();
+
+	// give any osc change already queued for a retired parameter time to drain, then stop purging
+	wait_for_blocks(2);
+	purgeRetiredParams_ = false;
+	wait_for_blocks(1);
+	retiredParams_.clear();
+
+	// nothing refers to the old graph any more
+	pthread_mutex_lock(&programLock_);
+	delete oldProgram;
+	pthread_mutex_unlock(&programLock_);
+	for(unsigned int n = 0; n < retired.size(); ++n){
+		delete retired[n];
+	}
+	for(JackPortMap::iterator it = ports_.begin(); it != ports_.end();){
+		if(claimedPorts_.count(it->first)){
+			++it;
+		} else {
+			delete it->second;
+			ports_.erase(it++);
+		}
+	}
+	adoptedPorts_.clear();
+
+	std::cout << "Session loaded, " << reused.size() << " objects reused, " << created.size()
+		<< " built, " << retired.size() << " retired" << std::endl;
+
+	/// create the disk threads, offline the diskstreams are read synchronously instead
+	if(!diskstreamThreadStarted_ && !is_offline()){
+		diskstreamThreadContinue_ = true; // this gets switched of on shutdown
+		for(int n = 0; n < std::max(options_.diskThreads_, 1); ++n){
+			pthread_t thread;
+			if(pthread_create (&thread, NULL, ResoundSession::diskstream_thread, this) == 0){
+				diskstreamThreads_.push_back(thread);
+			}
+		}
+		diskstreamThreadStarted_ = true;
+	}
+}
+
+void ResoundSession::reload_from_file(const std::string& path){
+	std::cout << "Reloading config from " << path << std::endl;
+	try {
+		xmlpp::DomParser parser;
+		parser.set_validate(false);
+		parser.set_substitute_entities(); //We just want the text to be resolved/unescaped automatically.
+		parser.parse_file(path);
+		if(!parser) throw Exception("Could not parse the xml file.");
+		const xmlpp::Element* nodeElement = parser.get_document()->get_root_node(); //deleted by DomParser.
+		if(!nodeElement || nodeElement->get_name() != "resoundnv"){
+			throw Exception("Resoundnv XML node not found.");
+		}
+		load_from_xml(nodeElement);
+	} catch(const std::exception& ex){
+		std::cout << "Reload failed, the running session is unchanged : " << ex.what() << std::endl;
+	}
+}
+
+void ResoundSession::poll_reload(){
+	if(!reloadRequested_) return;
+	reloadRequested_ = false;
+	reload_from_file(options_.inputXML_);
+}
+
+bool ResoundSession::can_reuse(DynamicObject* ob, const ObjectIdSet& dependencies, const DynamicObjectMap& oldObjects){
+	// buffers are cut for the block size at load, a larger block needs every object built again
+	if(program_ && get_buffer_size() > program_->get_block_size()) return false;
+	// everything it looked up must have been carried over too, otherwise it would point at stale objects
+	for(ObjectIdSet::const_iterator it = dependencies.begin(); it != dependencies.end(); ++it){
+		DynamicObjectMap::iterator now = dynamicObjects_.find(*it);
+		DynamicObjectMap::const_iterator before = oldObjects.find(*it);
+		if(now == dynamicObjects_.end() || before == oldObjects.end() || now->second != before->second) return false;
+	}
+	// bus lanes are reassigned when the new schedule is planned, which would race the running one
+	Behaviour* behaviour = dynamic_cast<Behaviour*>(ob);
+	if(dspPool_ && behaviour && behaviour->supports_bus_lanes()) return false;
+	return true;
+}
+
+/// milliseconds to wait on the process callback before taking it to have stopped, far longer than any block
+static const unsigned int PROCESS_TIMEOUT_MS = 2000;
+
+void ResoundSession::swap_program(DspProgram* program){
+	++programGeneration_;
+	if(!dsp_is_running()){
+		program_ = program;
+		return;
+	}
+	__sync_synchronize();
+	pendingProgram_ = program;
+	for(unsigned int ms = 0; pendingProgram_; ++ms){
+		if(!dsp_is_running() || ms >= PROCESS_TIMEOUT_MS){
+			// jack has gone or stopped calling process, nothing will take it so swap directly
+			if(__sync_bool_compare_and_swap(&pendingProgram_, program, (DspProgram*)0)){
+				std::cout << "Process callback is not running, swapping the program directly" << std::endl;
+				program_ = program;
 			}
+			return;
 		}
+		usleep(1000);
+	}
+}
+
+void ResoundSession::wait_for_blocks(unsigned int count){
+	unsigned int start = blockCount_;
+	for(unsigned int ms = 0; blockCount_ - start < count; ++ms){
+		if(!dsp_is_running() || ms >= PROCESS_TIMEOUT_MS) return;
+		usleep(1000);
+	}
+}
 
+void ResoundSession::register_parameter_address(BParam* param){
+	if(loadingId_ != ""){
+		loadedParams_.push_back(param);
+	} else {
+		add_target(param->get_address(), BParam::lo_cb_params, param);
+		publish_targets();
 	}
-	// now loaded so sort out the fast lookup object tables
-	build_dsp_object_lookups();
+}
 
-	/// create the disk thread
-	pthread_create (&diskstreamThreadId_, NULL, ResoundSession::diskstream_thread, this);
+JackPort* ResoundSession::get_port(ObjectId id){
+	JackPortMap::iterator it = ports_.find(id);
+	return it == ports_.end() ? 0 : it->second;
+}
 
+void ResoundSession::fill_diskstreams(jack_nframes_t nframes){
+	for(unsigned int n = 0; n < diskStreams_.size(); ++n){
+		Diskstream* stream = diskStreams_[n];
+		while(stream->get_buffered_frames() < nframes){
+			if(stream->disk_process() == 0) break; // stopped
+		}
+	}
+}
+
+JackPort* ResoundSession::create_port(ObjectId id, JackPortFlags flags){
+	JackPortMap::iterator it = ports_.find(id);
+	if(it == ports_.end()){
+		JackPort* port = new JackPort(id, flags, this);
+		ports_[id] = port;
+		claimedPorts_.insert(id);
+		return port;
+	}
+	// the object being replaced had this port, take it over rather than drop it from the jack graph
+	JackPort* port = it->second;
+	if(claimedPorts_.count(id) || port->get_flags() != flags){
+		throw Exception("Cannot reuse jack port, it is already in use or its direction has changed.");
+	}
+	adoptedPorts_.push_back(std::make_pair(port, port->get_connections()));
+	port->disconnect_all();
+	claimedPorts_.insert(id);
+	return port;
 }
 
 Behaviour* ResoundSession::create_behaviour_from_node(const xmlpp::Node* node){
@@ -325,6 +802,7 @@ void ResoundSession::register_dynamic_object(ObjectId id, DynamicObject* ob){
 	DynamicObjectMap::iterator it = dynamicObjects_.find(id);
 	if(it == dynamicObjects_.end()){
 		dynamicObjects_[id] = ob;
+		dynamicObjectOrder_.push_back(ob);
 		std::cout << "Registered DynamicObject " << id << std::endl;
 	} else {
 		throw Exception("non-unique name for dynamic object in session");
@@ -339,6 +817,8 @@ DynamicObject* ResoundSession::get_dynamic_object(ObjectId id){
   	ObjectId left = id.substr(0,pos); 
 	DynamicObjectMap::iterator it = dynamicObjects_.find(left);
 	if(it != dynamicObjects_.end()){
+		// remember what the object being built refers to, a reload needs to know
+		if(loadingId_ != "" && left != loadingId_) dependencies_[loadingId_].insert(left);
 		return it->second;
 	} else {
 		throw Exception((std::string("Dynamic object with name ") + id + std::string(" not found")).c_str());
@@ -370,74 +850,236 @@ Loudspeaker* ResoundSession::resolve_loudspeaker(ObjectId id){
 
 
 
-void ResoundSession::build_dsp_object_lookups(){
+DspProgram* ResoundSession::build_dsp_object_lookups(LoudspeakerVector& loudspeakers, DiskstreamVector& diskstreams){
 	
-	// TODO Lock dsp mutex here, this thread should wait for the dsp thread
-	loudspeakers_.clear();
-	behaviours_.clear();
+	// the running session is untouched, load_from_xml swaps these in at a block boundary
+	DspProgram::BehaviourVector behaviours;
+
+	// document order, the graph compiler only uses it to break ties
+	for(unsigned int n = 0; n < dynamicObjectOrder_.size(); ++n){
+		DynamicObject* ob = dynamicObjectOrder_[n];
+		Diskstream* diskstream = dynamic_cast<Diskstream*>( ob );
+		Loudspeaker* loudspeaker = dynamic_cast<Loudspeaker*>( ob );
+		Behaviour* behaviour = dynamic_cast<Behaviour*>( ob );
+		if(diskstream) { diskstreams.push_back(diskstream); }
+		if(loudspeaker) { loudspeakers.push_back(loudspeaker); }
+		if(behaviour) { behaviours.push_back(behaviour); }
 
-	DynamicObjectMap::iterator it = dynamicObjects_.begin();
-	for(;it != dynamicObjects_.end(); ++it){
-		Diskstream* diskstream = dynamic_cast<Diskstream*>( it->second );
-		Loudspeaker* loudspeaker = dynamic_cast<Loudspeaker*>( it->second );
-		Behaviour* behaviour = dynamic_cast<Behaviour*>( it->second );
-		if(diskstream) { diskStreams_.push_back(diskstream); }
-		if(loudspeaker) { loudspeakers_.push_back(loudspeaker); }
-		if(behaviour) { behaviours_.push_back(behaviour); }
+	}
+
+	DspProgram* program = new DspProgram(behaviours, loudspeakers, dspPool_);
+	program->print();
+	bufferArena_.print();
+	return program;
+}
 
+int ResoundSession::on_buffer_size(jack_nframes_t nframes){
+	// the buffers are cut for the block size at load, rebuild the session for the new one.
+	// the main thread may be loading, so only ask
+	if(program_){
+		std::cout << "Buffer size is now " << nframes << ", reloading" << std::endl;
+		request_reload();
 	}
+	return 0;
 }
 
 int ResoundSession::on_process(jack_nframes_t nframes){
 
-	// if we can, signal to the diskstream thread that more data can probably be loaded
-	// TODO put some sort of throttleing on this to allow jack to read a few blocks before bothering to fill buffers
-	if (pthread_mutex_trylock (&diskstreamThreadLock_) == 0) {
-		pthread_cond_signal (&diskstreamThreadReady_);
-		pthread_mutex_unlock (&diskstreamThreadLock_);
+	// signal to the diskstream thread that more data can probably be loaded, sem_post takes no lock.
+	// a thread that has not got round to the last post yet is not posted again
+	int pending = 0;
+	if(sem_getvalue(&diskstreamWake_, &pending) == 0 && pending == 0){
+		sem_post(&diskstreamWake_);
 	}
 
-	// loudspeakers must be preprocessed to clear buffers
-	for(unsigned int n = 0; n < loudspeakers_.size(); ++n){
-		loudspeakers_[n]->pre_process(nframes);
+	// parameter changes land together at the block boundary
+	paramQueue_.drain();
+
+	// timetagged changes land on their own frame, the block is split around them
+	jack_nframes_t blockStart = get_last_frame_time();
+	timedParamQueue_.fetch(blockStart);
+
+	// a reload hands its program over here, between blocks
+	if(pendingProgram_){
+		program_ = pendingProgram_;
+		__sync_synchronize();
+		pendingProgram_ = 0;
 	}
-	// behaviours sum to buffers
-	for(unsigned int n = 0; n < behaviours_.size(); ++n){
-		behaviours_[n]->process(nframes);
+	if(purgeRetiredParams_){
+		timedParamQueue_.purge(retiredParams_);
 	}
-	// loudspeakers can now be processed out
-	for(unsigned int n = 0; n < loudspeakers_.size(); ++n){
-		loudspeakers_[n]->post_process(nframes);
+
+	if(program_ && nframes > program_->get_block_size()){
+		// the buffers are too small for this block, play silence until the reload on_buffer_size asked for
+		program_->silence_outputs(nframes);
+	} else if(program_){
+		program_->pre_process(nframes);
+		jack_nframes_t offset = 0;
+		while(offset < nframes){
+			timedParamQueue_.apply_due(blockStart + offset);
+			jack_nframes_t len = timedParamQueue_.frames_until_next(blockStart + offset, nframes - offset);
+			program_->process(dspPool_, offset, len);
+			offset += len;
+		}
+		program_->post_process(dspPool_, nframes);
+	} else {
+		timedParamQueue_.apply_due(blockStart + nframes - 1);
 	}
+	++blockCount_;
 	return 0;
 }
 
+/// meter messages per bundle, about 5k which fits a datagram on any network
+static const int MAX_BUNDLE_MESSAGES = 128;
+/// a meter reading that moved less than this, about -100dB, is not sent again
+static const float METER_RESOLUTION = 0.00001f;
+
+static bool meter_unchanged(const MeterReading& a, const MeterReading& b){
+	return std::fabs(a.rms - b.rms) < METER_RESOLUTION && std::fabs(a.peak - b.peak) < METER_RESOLUTION
+		&& std::fabs(a.margin - b.margin) < METER_RESOLUTION;
+}
+
 void ResoundSession::send_osc_feedback(){
+	++feedbackTicks_;
+	// write the latest readings into the meter messages under the program lock, a reload may retire the bank
+	pthread_mutex_lock(&programLock_);
+	const MeterReading* latest;
+	if(!program_ || !program_->get_meters().read(latest)){
+		pthread_mutex_unlock(&programLock_);
+		return;
+	}
+	const MeterBank& bank = program_->get_meters();
+	if(meterGeneration_ != programGeneration_){
+		// a new program, one message per meter for as long as it runs
+		for(unsigned int n = 0; n < meterMessages_.size(); ++n){
+			lo_message_free(meterMessages_[n]);
+		}
+		meterMessages_.clear();
+		meterNames_.clear();
+		for(unsigned int n = 0; n < bank.size(); ++n){
+			lo_message msg = lo_message_new();
+			lo_message_add_float(msg, 0.0f);
+			lo_message_add_float(msg, 0.0f);
+			lo_message_add_float(msg, 0.0f);
+			// held here as well as by each bundle it is added to, lo_bundle_free only lets go of the bundle's
+			lo_message_incref(msg);
+			meterMessages_.push_back(msg);
+			meterNames_.push_back(bank.get_name(n));
+		}
+		meterGeneration_ = programGeneration_;
+	}
+	meterReadings_.assign(latest, latest + bank.size());
+	pthread_mutex_unlock(&programLock_);
+	for(unsigned int n = 0; n < meterMessages_.size(); ++n){
+		lo_arg** args = lo_message_get_argv(meterMessages_[n]);
+		args[0]->f = meterReadings_[n].rms;
+		args[1]->f = meterReadings_[n].peak;
+		args[2]->f = meterReadings_[n].margin;
+	}
 
-	for(unsigned int n = 0; n < loudspeakers_.size(); ++n){
-		VUMeter& meter = loudspeakers_[n]->get_vu_meter();
-		std::string addr(std::string("/")+loudspeakers_[n]->get_id());
-		send_osc_to_all_clients(addr.c_str(),"fff",meter.get_rms(),meter.get_peak(),meter.get_margin(),LO_ARGS_END);
+	const std::vector<Resound::ActiveClient>& clients = acquire_clients().clients;
+	pthread_mutex_lock(&meterLock_);
+	for(unsigned int c = 0; c < clients.size(); ++c){
+		MeterSubscription& s = meterSubscriptions_[clients[c].url];
+		if(s.divisor == 0 || feedbackTicks_ % s.divisor != 0) continue;
+		if(s.generation != meterGeneration_){
+			// resolve the names asked for against this program's meters
+			s.meters.clear();
+			for(unsigned int n = 0; n < meterNames_.size(); ++n){
+				if(s.names.empty() || s.names.count(meterNames_[n])) s.meters.push_back(n);
+			}
+			s.sent.assign(meterNames_.size(), MeterReading());
+			s.generation = meterGeneration_;
+			s.sends = 0;
+		}
+		// every meter about once a second whether it changed or not, and all of them on a new program
+		unsigned int refreshSends = (unsigned int)(options_.meterRate_ / s.divisor + 0.5f);
+		bool refresh = refreshSends < 2 || s.sends % refreshSends == 0;
+		++s.sends;
+
+		// one bundle per client rather than a packet per meter, split before it grows too big for a datagram
+		lo_bundle bundle = 0;
+		int messages = 0;
+		for(unsigned int m = 0; m < s.meters.size(); ++m){
+			unsigned int n = s.meters[m];
+			if(!refresh && meter_unchanged(s.sent[n], meterReadings_[n])) continue;
+			s.sent[n] = meterReadings_[n];
+			if(!bundle) bundle = lo_bundle_new(LO_TT_IMMEDIATE);
+			lo_bundle_add_message(bundle, meterNames_[n].c_str(), meterMessages_[n]);
+			if(++messages == MAX_BUNDLE_MESSAGES){
+				lo_send_bundle(clients[c].returnAddress, bundle);
+				lo_bundle_free(bundle);
+				bundle = 0;
+				messages = 0;
+			}
+		}
+		if(bundle){
+			lo_send_bundle(clients[c].returnAddress, bundle);
+			lo_bundle_free(bundle);
+		}
 	}
+	pthread_mutex_unlock(&meterLock_);
+	release_clients();
+}
+
+void ResoundSession::on_client_expired(const std::string& url){
+	pthread_mutex_lock(&meterLock_);
+	meterSubscriptions_.erase(url);
+	pthread_mutex_unlock(&meterLock_);
 }
 
 /// this should be called from the disk management thread
 void ResoundSession::diskstream_process(){
 	pthread_mutex_lock (&diskstreamThreadLock_);
-        diskstreamThreadContinue_ = true; // this gets switched of on shutdown
 	while(diskstreamThreadContinue_){
-		//printf("Diskstream load\n");
-		for(unsigned int n = 0; n < diskStreams_.size(); ++n){
-			diskStreams_[n]->disk_process();
+		// the stream with the fewest frames buffered underruns first, take it unless another thread has it
+		Diskstream* emptiest = 0;
+		size_t fewest = 0;
+		bool more = false;
+		for(unsigned int n = 0; n < diskStreams_.size() && diskReadHolds_ == 0; ++n){
+			Diskstream* stream = diskStreams_[n];
+			if(!stream->wants_read()) continue;
+			if(std::find(diskReads_.begin(), diskReads_.end(), stream) != diskReads_.end()) continue;
+			size_t buffered = stream->get_buffered_frames();
+			if(emptiest) more = true;
+			if(!emptiest || buffered < fewest){
+				emptiest = stream;
+				fewest = buffered;
+			}
 		}
-		//now wait for process thread to signal
-		pthread_cond_wait (&diskstreamThreadReady_, &diskstreamThreadLock_);
-
+		if(!emptiest){
+			//now wait for process thread to signal
+			pthread_mutex_unlock (&diskstreamThreadLock_);
+			while(sem_wait(&diskstreamWake_) != 0 && errno == EINTR){}
+			pthread_mutex_lock (&diskstreamThreadLock_);
+			continue;
+		}
+		// the read is made unlocked, should it be slow another thread carries on with the other streams
+		if(more) sem_post(&diskstreamWake_);
+		diskReads_.push_back(emptiest);
+		pthread_mutex_unlock (&diskstreamThreadLock_);
+		emptiest->disk_process();
+		pthread_mutex_lock (&diskstreamThreadLock_);
+		diskReads_.erase(std::find(diskReads_.begin(), diskReads_.end(), emptiest));
+		pthread_cond_broadcast(&diskReadDone_);
 	}
 	pthread_mutex_unlock (&diskstreamThreadLock_);
         printf("Diskstream shutdown\n");
 }
 
+void ResoundSession::hold_disk_reads(){
+	++diskReadHolds_;
+	while(!diskReads_.empty()){
+		pthread_cond_wait(&diskReadDone_, &diskstreamThreadLock_);
+	}
+}
+
+void ResoundSession::release_disk_reads(){
+	--diskReadHolds_;
+	// whatever was put off is read now
+	if(diskReadHolds_ == 0) sem_post(&diskstreamWake_);
+}
+
 void* ResoundSession::diskstream_thread (void *arg){
 	// cast arg to resound session
 	ResoundSession* session = (ResoundSession*) arg;
@@ -476,102 +1118,14 @@ BufferRefVector ResoundSession::lookup_buffer(ObjectId id){
             
         }
     }
+    // remember what the object being built refers to, a reload needs to know.
+    // a miss is recorded too so the object is rebuilt should the missing one appear.
+    if(loadingId_ != ""){
+        ObjectIdSet& dependencies = dependencies_[loadingId_];
+        if(ret.empty()) dependencies.insert(id.substr(0,id.find('.')));
+        for(unsigned int n = 0; n < ret.size(); ++n){
+            if(ret[n].creator != loadingId_) dependencies.insert(ret[n].creator);
+        }
+    }
     return ret;
 }
-
-// ------------------------------- Globals and entry point -----------------------------------
-
-CLIOptions g_options;
-
-void parse_command_arguments(int argc, char** argv){
-	// making use of boost::program options to deal with command arguments
-	namespace po = boost::program_options;
-
-	po::options_description desc("Usage: resoundnv-server");
-	desc.add_options()
-		("help", "Display this help message.")
-		("input", po::value<std::string>(&g_options.inputXML_)->default_value(""), "Input resound xml file, must be set!")
-		("port", po::value<std::string>(&g_options.oscPort_)->default_value("8000"), "OSC listening port")
-		("test", "Runs some internal testing code")
-		//("record", po::value<std::string>(), "Record loudspeakers to wav file <filename>.")
-		//("simulate", po::value<int>(), "Loudspeakers are simulated as point sources")
-
-	;
-
-	po::variables_map vm;
-	po::store(po::parse_command_line(argc, argv, desc), vm);
-	po::notify(vm);    
-
-	if (vm.count("help")) {
-		std::cout << desc << "\n";
-		exit(1);
-	}
-
-	if (vm.count("test")) {
-		test_dsp();
-		exit(1);
-	}
-
-	if (g_options.inputXML_ == ""){
-		std::cout << "Cannot continue, input resound XML file must be specified!\n";
-		std::cout << desc << "\n";
-		exit(1);
-	}
-
-}
-
-ResoundSession* g_session = 0;
-bool g_continue = false;
-
-void handle_sigint(int sig){
-        signal(SIGINT, handle_sigint);
-        g_continue = false;
-        printf("Interupted - shutting down\n");
-}
-
-int main(int argc, char** argv){
-
-	parse_command_arguments(argc,argv);
-	// for now we take the first arg and use it as the filename for xml
-	std::cout << "resoundnv server v0.0.1\n";
-	std::cout << "Loading config from " << g_options.inputXML_ << std::endl;
-
-	// loading and parsing the xml
-//	try
-//	{
-		xmlpp::DomParser parser;
-		parser.set_validate(false);
-		parser.set_substitute_entities(); //We just want the text to be resolved/unescaped automatically.
-		parser.parse_file(g_options.inputXML_);
-		if(parser){
-			const xmlpp::Node* pNode = parser.get_document()->get_root_node(); //deleted by DomParser.
-			const xmlpp::Element* nodeElement = dynamic_cast<const xmlpp::Element*>(pNode);
-			if(nodeElement)
-			{	
-				std::string name = nodeElement->get_name();
-				if(name=="resoundnv"){
-					std::cout << "Resoundnv XML node found, building session.\n";
-					g_session = new ResoundSession(g_options);
-					APP().set_session(g_session);
-					SESSION().load_from_xml(nodeElement);
-				}
-			}
-		}
-//	}
-//	catch(const std::exception& ex){
-//		std::cout << "XML Initialisation file parsing exception what()=" << ex.what() << std::endl;
-//		std::cout << "Server cannot continue"<< std::endl;
-//		std::exit(1);
-//	}
-        signal(SIGINT, handle_sigint);
-        g_continue = true;
-	while(g_continue){ // TODO this should really listen for incoming signals, see unix programming book.
-		usleep(100000); // around 10 fps
-		// use this thread to send some feedback
-		//session->update_clients();
-                if(g_session) g_session->send_osc_feedback();
-	}
-        delete g_session; // should invoke destructor
-        g_session=0;
-        return 0;
-}
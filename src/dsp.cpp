@@ -17,56 +17,58 @@
 //    along with Resound; if not, write to the Free Software
 //    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include "resoundnv/dsp.hpp"
+#include "resoundnv/bufferarena.hpp"
+#include <cstdio>
 #include <iostream>
+#include <cstdlib>
+#include <new>
 
 
-AudioBuffer::AudioBuffer() : buffer_(0) {
+AudioBuffer::AudioBuffer() : size_(0), buffer_(0), storage_(0), readGain_(1.0f), silent_(false), arena_(0) {
 }
 AudioBuffer::~AudioBuffer(){
 	destroy();
 
 }
-void AudioBuffer::allocate( size_t size ){
+void AudioBuffer::allocate( size_t size, BufferArena* arena ){
 	destroy();
-	buffer_ = new float[size];
+	if(arena){
+		storage_ = buffer_ = arena->allocate(size);
+		arena_ = arena;
+		size_ = size;
+		return;
+	}
+	// aligned to a cache line so the widest kernels take their aligned path
+	void* p = 0;
+	if(posix_memalign(&p, 64, sizeof(float) * size) != 0) throw std::bad_alloc();
+	storage_ = buffer_ = (float*)p;
 	size_ = size;
 
 }
 void AudioBuffer::clear(){
 	std::memset(buffer_, 0, sizeof(float) * size_);
 }
+void AudioBuffer::clear(size_t nframes){
+	std::memset(buffer_, 0, sizeof(float) * nframes);
+}
+void AudioBuffer::silence(size_t offset, size_t nframes){
+	std::memset(buffer_ + offset, 0, sizeof(float) * nframes);
+	silent_ = true;
+}
 void AudioBuffer::destroy(){
-	if( buffer_ ) delete [] buffer_;
+	if( storage_ && arena_ ) arena_->release(storage_, size_);
+	else if( storage_ ) free(storage_);
+	storage_ = 0;
 	buffer_ = 0;
+	arena_ = 0;
 	size_ = 0;
 }
 
+const float VUMeter::PEAK_FALLOFF = 0.9999f;
+
 void ab_copy(const float* src, float* dest, size_t N ){
 	std::memcpy(dest, src, sizeof(float) * N);
 }
-void ab_copy_with_gain(const float* src, float* dest, size_t N, float gain){
-	for(size_t n=0; n < N; ++n){
-		dest[n] = src[n] * gain;
-	}
-}
-void ab_sum_with_gain(const float* src, float* dest, size_t N, float gain){
-	for(size_t n=0; n < N; ++n){
-		dest[n] += src[n] * gain;
-	}
-}
-
-void ab_sum_with_gain_linear_interp(const float* src, float* dest, size_t N, float gain, float oldGain, size_t interpSize){
-	assert(interpSize<=N);
-	float interpStep = 1.0/(float)interpSize;
-	for(size_t n=0; n < interpSize; ++n){
-		float v = interpStep *(float)n;
-		dest[n] += src[n] * (v*gain+(1-v)*oldGain);
-	}
-
-	for(size_t n=interpSize; n < N; ++n){
-		dest[n] += src[n] * gain;
-	}
-}
 
 void avg_signal_in_buffer(const float* src, size_t N){
 	float peak = 0.0f;
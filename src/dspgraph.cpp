@@ -0,0 +1,397 @@
+//    Resound
+//    Copyright 2009 David Moore and James Mooney
+//
+//    This file is part of Resound.
+//
+//    Resound is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    Resound is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Resound; if not, write to the Free Software
+//    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include "resoundnv/dspgraph.hpp"
+#include "resoundnv/core.hpp"
+#include <sstream>
+
+DspProgram::DspProgram(const BehaviourVector& behaviours, const LoudspeakerVector& loudspeakers, DspWorkerPool* pool) :
+		loudspeakers_(loudspeakers),
+		bypassChanged_(true),
+		schedule_(0),
+		matrix_(0),
+		storageSize_(0),
+		remap_(true),
+		blockSize_(SESSION().get_buffer_size())
+{
+	int count = behaviours.size();
+
+	AudioBufferSet buses;
+	for(unsigned int n = 0; n < loudspeakers_.size(); ++n){
+		buses.insert(loudspeakers_[n]->get_buffer());
+	}
+
+	// find out who writes each buffer
+	std::vector<AudioBufferSet> reads(count), writes(count);
+	typedef std::map<AudioBuffer*, std::vector<int> > WriterMap;
+	WriterMap writers;
+	for(int n = 0; n < count; ++n){
+		behaviours[n]->get_buffer_usage(reads[n], writes[n]);
+		for(AudioBufferSet::iterator it = writes[n].begin(); it != writes[n].end(); ++it){
+			writers[*it].push_back(n);
+		}
+	}
+
+	// a behaviour depends on every writer of every buffer it reads
+	std::vector<std::set<int> > producers(count);
+	std::vector<std::set<int> > consumers(count);
+	for(int n = 0; n < count; ++n){
+		for(AudioBufferSet::iterator it = reads[n].begin(); it != reads[n].end(); ++it){
+			WriterMap::iterator w = writers.find(*it);
+			if(w == writers.end()) continue;
+			for(unsigned int m = 0; m < w->second.size(); ++m){
+				int p = w->second[m];
+				if(p == n) continue;
+				producers[n].insert(p);
+				consumers[p].insert(n);
+			}
+		}
+	}
+
+	// only behaviours that lead to a loudspeaker are worth running
+	std::vector<bool> live(count, false);
+	std::vector<int> stack;
+	for(int n = 0; n < count; ++n){
+		for(AudioBufferSet::iterator it = writes[n].begin(); it != writes[n].end(); ++it){
+			if(buses.count(*it)){
+				live[n] = true;
+				stack.push_back(n);
+				break;
+			}
+		}
+	}
+	while(!stack.empty()){
+		int n = stack.back();
+		stack.pop_back();
+		for(std::set<int>::iterator it = producers[n].begin(); it != producers[n].end(); ++it){
+			if(!live[*it]){
+				live[*it] = true;
+				stack.push_back(*it);
+			}
+		}
+	}
+
+	// topological sort, ties go to whichever came first in the document
+	std::vector<int> pending(count, 0);
+	std::set<int> ready;
+	for(int n = 0; n < count; ++n){
+		pending[n] = producers[n].size();
+		if(pending[n] == 0) ready.insert(n);
+	}
+	int sorted = 0;
+	while(!ready.empty()){
+		int n = *ready.begin();
+		ready.erase(ready.begin());
+		++sorted;
+		if(live[n]){
+			behaviours_.push_back(behaviours[n]);
+		} else {
+			pruned_.push_back(behaviours[n]);
+		}
+		for(std::set<int>::iterator it = consumers[n].begin(); it != consumers[n].end(); ++it){
+			if(--pending[*it] == 0) ready.insert(*it);
+		}
+	}
+	if(sorted != count){
+		throw Exception("Behaviour graph contains a cycle, a behaviour cannot depend on its own output.");
+	}
+
+	// a livestream read only through routes need not copy its capture port, the routes apply its gain.
+	// its buffer must not be written by anything else, the capture buffer belongs to jack.
+	std::map<AudioBuffer*, int> readers, otherWriters;
+	for(unsigned int n = 0; n < behaviours_.size(); ++n){
+		AudioBufferSet r, w;
+		behaviours_[n]->get_buffer_usage(r, w);
+		bool routed = behaviours_[n]->applies_read_gain();
+		for(AudioBufferSet::iterator it = r.begin(); it != r.end(); ++it){
+			if(!routed) readers[*it]++;
+		}
+		if(dynamic_cast<Livestream*>(behaviours_[n])) continue;
+		for(AudioBufferSet::iterator it = w.begin(); it != w.end(); ++it){
+			otherWriters[*it]++;
+		}
+	}
+	BehaviourVector remaining;
+	for(unsigned int n = 0; n < behaviours_.size(); ++n){
+		Livestream* input = dynamic_cast<Livestream*>(behaviours_[n]);
+		if(!input){
+			remaining.push_back(behaviours_[n]);
+			continue;
+		}
+		AudioBuffer* buffer = &input->get_buffer(0);
+		if(!SESSION().get_options().copyIn_ && !readers.count(buffer) && !otherWriters.count(buffer)){
+			aliasedInputs_.push_back(input);
+		} else {
+			copiedInputs_.push_back(input);
+			remaining.push_back(input);
+		}
+	}
+	behaviours_.swap(remaining);
+
+	// the routeset behaviours leave their summing to one matrix run after everything else,
+	// they are then only called for their control rate work
+	MixMatrix::BehaviourSet mixed;
+	if(SESSION().get_options().mixMatrix_ && MixMatrix::can_mix(behaviours_, buses)){
+		matrix_ = new MixMatrix(behaviours_);
+		if(matrix_->get_route_count() > 0){
+			behaviours_.push_back(matrix_);
+			mixed = matrix_->get_mixed();
+		} else {
+			delete matrix_;
+			matrix_ = 0;
+		}
+	}
+
+	// emit the flat op list
+	for(unsigned int n = 0; n < behaviours_.size(); ++n){
+		Behaviour* b = behaviours_[n];
+		allOps_.push_back(DspOp(mixed.count(b) ? b->get_control_func() : b->get_process_func(), b));
+		allOpTimers_.push_back(stats_.add_timer(behaviours_[n], behaviours_[n]->get_id()));
+	}
+	// bypass only ever removes ops, filtering on the dsp thread never allocates
+	ops_.reserve(allOps_.size());
+	opTimers_.reserve(allOpTimers_.size());
+	for(unsigned int n = 0; n < loudspeakers_.size(); ++n){
+		loudspeakerTimers_.push_back(stats_.add_timer(loudspeakers_[n], loudspeakers_[n]->get_id()));
+	}
+
+	if(pool){
+		schedule_ = new DspSchedule(behaviours_, mixed, loudspeakers_, pool->get_thread_count(), stats_);
+	}
+
+	plan_buffers();
+
+	// buses first, in the order feedback has always been sent
+	for(unsigned int n = 0; n < loudspeakers_.size(); ++n){
+		meters_.add("/" + loudspeakers_[n]->get_id(), loudspeakers_[n]->get_buffer(), &loudspeakers_[n]->get_vu_meter(), true);
+	}
+	BehaviourVector metered(behaviours_);
+	metered.insert(metered.end(), aliasedInputs_.begin(), aliasedInputs_.end());
+	for(unsigned int n = 0; n < metered.size(); ++n){
+		Behaviour* b = metered[n];
+		if(!b->is_metered()) continue;
+		for(int i = 0; i < b->get_buffer_count(); ++i){
+			std::stringstream name;
+			name << "/" << b->get_id() << "." << i;
+			meters_.add(name.str(), &b->get_buffer(i), &b->get_vu_meter(i), false);
+		}
+	}
+	meters_.finalise(SESSION().get_sample_rate() * MeterBank::WINDOW_MS / 1000);
+}
+
+DspProgram::~DspProgram(){
+	delete schedule_;
+	delete matrix_;
+	for(unsigned int n = 0; n < storage_.size(); ++n){
+		SESSION().get_buffer_arena().release(storage_[n], storageSize_);
+	}
+}
+
+void DspProgram::plan_buffers(){
+	// every buffer is written by the behaviour that owns it, find the last step reading it.
+	// a step is an op when running serially, a whole level of the parallel schedule otherwise
+	// as everything in a level runs at once
+	std::map<AudioBuffer*, int> writerCount;
+	std::map<AudioBuffer*, int> lastRead;
+	std::vector<int> steps(behaviours_.size());
+	for(unsigned int n = 0; n < behaviours_.size(); ++n){
+		steps[n] = schedule_ ? schedule_->get_level(behaviours_[n]) : (int)n;
+		AudioBufferSet reads, writes;
+		behaviours_[n]->get_buffer_usage(reads, writes);
+		for(AudioBufferSet::iterator it = writes.begin(); it != writes.end(); ++it){
+			writerCount[*it]++;
+		}
+		if(steps[n] < 0) continue;
+		for(AudioBufferSet::iterator it = reads.begin(); it != reads.end(); ++it){
+			if(lastRead[*it] < steps[n]) lastRead[*it] = steps[n];
+		}
+	}
+
+	for(unsigned int n = 0; n < behaviours_.size(); ++n){
+		Behaviour* b = behaviours_[n];
+		for(int i = 0; i < b->get_buffer_count(); ++i){
+			BufferMapping m;
+			m.buffer = &b->get_buffer(i);
+			m.producer = b;
+			m.index = i;
+			m.first = steps[n];
+			m.last = lastRead.count(m.buffer) ? lastRead[m.buffer] : steps[n];
+			if(m.last < m.first) m.last = m.first;
+			m.storage = -1;
+			mappings_.push_back(m);
+		}
+	}
+	for(unsigned int n = 0; n < pruned_.size(); ++n){
+		// not run, but they may still point at the storage of an earlier program
+		for(int i = 0; i < pruned_[n]->get_buffer_count(); ++i){
+			BufferMapping m = { &pruned_[n]->get_buffer(i), pruned_[n], i, -1, -1, -1 };
+			mappings_.push_back(m);
+		}
+	}
+	if(!SESSION().get_options().reuseBuffers_) return;
+
+	// linear scan in step order, like a register allocator. lifetimes are inclusive, a behaviour
+	// reading one buffer and writing another must not find them in the same storage
+	std::vector<size_t> order;
+	for(unsigned int n = 0; n < mappings_.size(); ++n){
+		const BufferMapping& m = mappings_[n];
+		// a livestream repoints its own buffer every block, a buffer written by
+		// anything else as well has no single lifetime
+		if(m.first < 0 || dynamic_cast<Livestream*>(m.producer) || writerCount[m.buffer] != 1) continue;
+		// metered at the end of the block, after any later buffer would have overwritten it
+		if(m.producer->is_metered()) continue;
+		// buffers are all a block long, anything else keeps its own
+		if(storageSize_ == 0) storageSize_ = m.buffer->get_size();
+		if(m.buffer->get_size() != storageSize_) continue;
+		order.push_back(n);
+	}
+	for(unsigned int n = 1; n < order.size(); ++n){
+		size_t k = order[n];
+		unsigned int j = n;
+		for(; j > 0 && mappings_[order[j-1]].first > mappings_[k].first; --j) order[j] = order[j-1];
+		order[j] = k;
+	}
+	std::vector<int> busyUntil;
+	for(unsigned int n = 0; n < order.size(); ++n){
+		BufferMapping& m = mappings_[order[n]];
+		size_t s = 0;
+		while(s < busyUntil.size() && busyUntil[s] >= m.first) ++s;
+		if(s == busyUntil.size()){
+			busyUntil.push_back(m.last);
+		} else {
+			busyUntil[s] = m.last;
+		}
+		m.storage = s;
+	}
+	for(unsigned int n = 0; n < busyUntil.size(); ++n){
+		storage_.push_back(SESSION().get_buffer_arena().allocate(storageSize_));
+	}
+}
+
+void DspProgram::map_buffers(){
+	for(unsigned int n = 0; n < mappings_.size(); ++n){
+		const BufferMapping& m = mappings_[n];
+		if(m.storage >= 0 && !m.producer->is_bypassed()){
+			m.buffer->alias(storage_[m.storage]);
+		} else if(m.storage >= 0){
+			// it stays silent while bypassed, which the shared storage would not
+			m.buffer->alias(0);
+			m.buffer->clear();
+			m.buffer->set_silent(true);
+		} else {
+			// may still use the storage of an earlier program
+			m.buffer->alias(0);
+		}
+	}
+}
+
+void DspProgram::pre_process(jack_nframes_t nframes){
+#ifdef RESOUND_DSP_STATS
+	stats_.begin_block();
+#endif
+	// bypass parameters land with the rest at the block boundary, a bypassed behaviour has no op
+	for(unsigned int n = 0; n < behaviours_.size(); ++n){
+		if(behaviours_[n]->update_bypass()) bypassChanged_ = true;
+	}
+	if(bypassChanged_){
+		ops_.clear();
+		opTimers_.clear();
+		for(unsigned int n = 0; n < behaviours_.size(); ++n){
+			if(behaviours_[n]->is_bypassed()) continue;
+			ops_.push_back(allOps_[n]);
+			opTimers_.push_back(allOpTimers_[n]);
+		}
+		bypassChanged_ = false;
+		remap_ = true;
+	}
+	if(remap_){
+		map_buffers();
+		remap_ = false;
+	}
+
+	// before any control rate work, it reads the route levels
+	for(unsigned int n = 0; n < aliasedInputs_.size(); ++n){
+		aliasedInputs_[n]->update_bypass();
+		if(!aliasedInputs_[n]->is_bypassed()) aliasedInputs_[n]->alias_port(nframes);
+	}
+	for(unsigned int n = 0; n < copiedInputs_.size(); ++n){
+		copiedInputs_[n]->unalias_port();
+	}
+	if(schedule_){
+		schedule_->pre_process(nframes);
+		return;
+	}
+	DSP_TIMER_START(t);
+	for(unsigned int n = 0; n < loudspeakers_.size(); ++n){
+		loudspeakers_[n]->pre_process(nframes);
+		DSP_TIMER_LAP(t, loudspeakerTimers_[n]);
+	}
+}
+
+void DspProgram::silence_outputs(jack_nframes_t nframes){
+	for(unsigned int n = 0; n < loudspeakers_.size(); ++n){
+		std::memset(loudspeakers_[n]->get_port()->get_audio_buffer(nframes), 0, sizeof(float) * nframes);
+	}
+}
+
+void DspProgram::post_process(DspWorkerPool* pool, jack_nframes_t nframes){
+	// before the loudspeakers apply their gain, the buses are metered as they were summed
+	meters_.process(nframes);
+	if(schedule_){
+		schedule_->post_process(*pool, nframes);
+	} else {
+		DSP_TIMER_START(t);
+		for(unsigned int n = 0; n < loudspeakers_.size(); ++n){
+			loudspeakers_[n]->post_process(nframes);
+			DSP_TIMER_LAP(t, loudspeakerTimers_[n]);
+		}
+	}
+#ifdef RESOUND_DSP_STATS
+	stats_.end_block();
+#endif
+}
+
+void DspProgram::print(){
+	std::cout << "DspProgram " << ops_.size() << " ops, execution order:" << std::endl;
+	for(unsigned int n = 0; n < behaviours_.size(); ++n){
+		std::cout << "  " << n << " " << behaviours_[n]->get_id();
+		if(matrix_ && matrix_->mixes(behaviours_[n])) std::cout << ", control only";
+		if(behaviours_[n]->is_bypassed()) std::cout << ", bypassed";
+		std::cout << std::endl;
+	}
+	for(unsigned int n = 0; n < aliasedInputs_.size(); ++n){
+		std::cout << "  input " << aliasedInputs_[n]->get_id() << " reads its capture port in place" << std::endl;
+	}
+	if(matrix_) matrix_->print();
+	for(unsigned int n = 0; n < pruned_.size(); ++n){
+		std::cout << "  pruned " << pruned_[n]->get_id() << ", its output reaches no loudspeaker" << std::endl;
+	}
+	if(schedule_) schedule_->print();
+	size_t pooled = 0;
+	for(unsigned int n = 0; n < mappings_.size(); ++n){
+		if(mappings_[n].storage >= 0) ++pooled;
+	}
+	std::cout << "  " << pooled << " buffers on " << storage_.size() << " physical buffers" << std::endl;
+	for(unsigned int n = 0; n < mappings_.size(); ++n){
+		const BufferMapping& m = mappings_[n];
+		if(m.storage < 0) continue;
+		std::cout << "    " << m.producer->get_id() << "." << m.index << " -> physical " << m.storage
+			<< ", live " << m.first << ".." << m.last << std::endl;
+	}
+}
@@ -0,0 +1,617 @@
+//    Resound
+//    Copyright 2009 David Moore and James Mooney
+//
+//    This file is part of Resound.
+//
+//    Resound is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    Resound is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Resound; if not, write to the Free Software
+//    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include "resoundnv/dsp.hpp"
+#include <stdint.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define RESOUND_X86_KERNELS
+#endif
+
+// the buffer kernels in several instruction sets, one is picked at startup by dsp_select_kernels.
+// every version shares the ramp arithmetic of the scalar one, oldGain + step * n,
+// and mix adds the terms of a frame in the same order, so they only differ by the rounding
+// of a fused multiply add where the cpu has one. peak_and_squares adds its squares lane by lane,
+// the sum of squares differs by rounding, which metering never sees.
+
+// -------------------------------------------- scalar
+
+static void copy_with_gain_scalar(const float* src, float* dest, size_t N, float gain){
+	for(size_t n=0; n < N; ++n){
+		dest[n] = src[n] * gain;
+	}
+}
+static void sum_with_gain_scalar(const float* src, float* dest, size_t N, float gain){
+	for(size_t n=0; n < N; ++n){
+		dest[n] += src[n] * gain;
+	}
+}
+static void sum_with_gain_linear_interp_scalar(const float* src, float* dest, size_t N, float gain, float oldGain, size_t interpSize){
+	// a short (sub) block completes the ramp early
+	if(interpSize > N) interpSize = N;
+	float step = (gain - oldGain) / (float)interpSize;
+	for(size_t n=0; n < interpSize; ++n){
+		dest[n] += src[n] * (oldGain + step * (float)n);
+	}
+	sum_with_gain_scalar(src + interpSize, dest + interpSize, N - interpSize, gain);
+}
+
+/// one frame of DspKernels::mix inside the ramp, d is dest + offset
+static inline void mix_ramp_frame(const MixTerm* terms, size_t count, float* d, size_t offset, size_t n){
+	float acc = d[n];
+	for(size_t k = 0; k < count; ++k){
+		float i = (float)n < terms[k].rampFrames ? (float)n : terms[k].rampFrames;
+		acc += terms[k].src[offset + n] * (terms[k].start + terms[k].step * i);
+	}
+	d[n] = acc;
+}
+/// one frame of DspKernels::mix after the ramp
+static inline void mix_frame(const MixTerm* terms, size_t count, float* d, size_t offset, size_t n){
+	float acc = d[n];
+	for(size_t k = 0; k < count; ++k){
+		acc += terms[k].src[offset + n] * terms[k].gain;
+	}
+	d[n] = acc;
+}
+static void mix_scalar(const MixTerm* terms, size_t count, float* dest, size_t offset, size_t begin, size_t end, size_t rampEnd){
+	float* d = dest + offset;
+	size_t rampStop = rampEnd < end ? rampEnd : end;
+	size_t n = begin;
+	for(; n < rampStop; ++n){
+		mix_ramp_frame(terms, count, d, offset, n);
+	}
+	for(; n < end; ++n){
+		mix_frame(terms, count, d, offset, n);
+	}
+}
+
+static void peak_and_squares_scalar(const float* src, size_t N, float* peak, float* sumOfSquares){
+	float p = 0.0f;
+	float s = 0.0f;
+	for(size_t n = 0; n < N; ++n){
+		float v = src[n];
+		float mag = v < 0.0f ? -v : v;
+		p = p < mag ? mag : p;
+		s += v * v;
+	}
+	*peak = p;
+	*sumOfSquares = s;
+}
+
+static void deinterleave_scalar(const float* src, float* const* dest, size_t channels, size_t frames){
+	for(size_t c = 0; c < channels; ++c){
+		float* d = dest[c];
+		const float* s = src + c;
+		for(size_t n = 0; n < frames; ++n){
+			d[n] = s[n * channels];
+		}
+	}
+}
+
+#ifdef RESOUND_X86_KERNELS
+
+/// true if every pointer sits on a boundary of the given power of two
+static inline bool is_aligned(const float* a, const float* b, uintptr_t alignment){
+	return (((uintptr_t)a | (uintptr_t)b) & (alignment - 1)) == 0;
+}
+
+// -------------------------------------------- sse2
+
+__attribute__((target("sse2")))
+static void copy_with_gain_sse2(const float* src, float* dest, size_t N, float gain){
+	__m128 g = _mm_set1_ps(gain);
+	size_t n = 0;
+	if(is_aligned(src, dest, 16)){
+		for(; n + 4 <= N; n += 4){
+			_mm_store_ps(dest + n, _mm_mul_ps(_mm_load_ps(src + n), g));
+		}
+	} else {
+		for(; n + 4 <= N; n += 4){
+			_mm_storeu_ps(dest + n, _mm_mul_ps(_mm_loadu_ps(src + n), g));
+		}
+	}
+	for(; n < N; ++n){
+		dest[n] = src[n] * gain;
+	}
+}
+__attribute__((target("sse2")))
+static void sum_with_gain_sse2(const float* src, float* dest, size_t N, float gain){
+	__m128 g = _mm_set1_ps(gain);
+	size_t n = 0;
+	if(is_aligned(src, dest, 16)){
+		for(; n + 4 <= N; n += 4){
+			_mm_store_ps(dest + n, _mm_add_ps(_mm_load_ps(dest + n), _mm_mul_ps(_mm_load_ps(src + n), g)));
+		}
+	} else {
+		for(; n + 4 <= N; n += 4){
+			_mm_storeu_ps(dest + n, _mm_add_ps(_mm_loadu_ps(dest + n), _mm_mul_ps(_mm_loadu_ps(src + n), g)));
+		}
+	}
+	for(; n < N; ++n){
+		dest[n] += src[n] * gain;
+	}
+}
+__attribute__((target("sse2")))
+static void sum_with_gain_linear_interp_sse2(const float* src, float* dest, size_t N, float gain, float oldGain, size_t interpSize){
+	if(interpSize > N) interpSize = N;
+	float step = (gain - oldGain) / (float)interpSize;
+	// the ramp index is carried in a register, integers are exact in a float so no error builds up
+	__m128 index = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+	__m128 width = _mm_set1_ps(4.0f);
+	__m128 s = _mm_set1_ps(step);
+	__m128 o = _mm_set1_ps(oldGain);
+	size_t n = 0;
+	for(; n + 4 <= interpSize; n += 4){
+		__m128 g = _mm_add_ps(o, _mm_mul_ps(s, index));
+		_mm_storeu_ps(dest + n, _mm_add_ps(_mm_loadu_ps(dest + n), _mm_mul_ps(_mm_loadu_ps(src + n), g)));
+		index = _mm_add_ps(index, width);
+	}
+	for(; n < interpSize; ++n){
+		dest[n] += src[n] * (oldGain + step * (float)n);
+	}
+	sum_with_gain_sse2(src + n, dest + n, N - n, gain);
+}
+
+__attribute__((target("sse2")))
+static void mix_sse2(const MixTerm* terms, size_t count, float* dest, size_t offset, size_t begin, size_t end, size_t rampEnd){
+	float* d = dest + offset;
+	size_t rampStop = rampEnd < end ? rampEnd : end;
+	size_t n = begin;
+	__m128 iota = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+	for(; n + 4 <= rampStop; n += 4){
+		__m128 index = _mm_add_ps(_mm_set1_ps((float)n), iota);
+		__m128 acc = _mm_loadu_ps(d + n);
+		for(size_t k = 0; k < count; ++k){
+			__m128 i = _mm_min_ps(index, _mm_set1_ps(terms[k].rampFrames));
+			__m128 g = _mm_add_ps(_mm_set1_ps(terms[k].start), _mm_mul_ps(_mm_set1_ps(terms[k].step), i));
+			acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(terms[k].src + offset + n), g));
+		}
+		_mm_storeu_ps(d + n, acc);
+	}
+	for(; n < rampStop; ++n){
+		mix_ramp_frame(terms, count, d, offset, n);
+	}
+	// four vectors of frames per pass, each term is fetched once for all of them
+	for(; n + 16 <= end; n += 16){
+		__m128 a0 = _mm_loadu_ps(d + n);
+		__m128 a1 = _mm_loadu_ps(d + n + 4);
+		__m128 a2 = _mm_loadu_ps(d + n + 8);
+		__m128 a3 = _mm_loadu_ps(d + n + 12);
+		for(size_t k = 0; k < count; ++k){
+			const float* s = terms[k].src + offset + n;
+			__m128 g = _mm_set1_ps(terms[k].gain);
+			a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_loadu_ps(s), g));
+			a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_loadu_ps(s + 4), g));
+			a2 = _mm_add_ps(a2, _mm_mul_ps(_mm_loadu_ps(s + 8), g));
+			a3 = _mm_add_ps(a3, _mm_mul_ps(_mm_loadu_ps(s + 12), g));
+		}
+		_mm_storeu_ps(d + n, a0);
+		_mm_storeu_ps(d + n + 4, a1);
+		_mm_storeu_ps(d + n + 8, a2);
+		_mm_storeu_ps(d + n + 12, a3);
+	}
+	for(; n + 4 <= end; n += 4){
+		__m128 acc = _mm_loadu_ps(d + n);
+		for(size_t k = 0; k < count; ++k){
+			acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(terms[k].src + offset + n), _mm_set1_ps(terms[k].gain)));
+		}
+		_mm_storeu_ps(d + n, acc);
+	}
+	for(; n < end; ++n){
+		mix_frame(terms, count, d, offset, n);
+	}
+}
+
+__attribute__((target("sse2")))
+static void peak_and_squares_sse2(const float* src, size_t N, float* peak, float* sumOfSquares){
+	// clearing the sign bit is the absolute value
+	__m128 mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	__m128 p = _mm_setzero_ps();
+	__m128 s = _mm_setzero_ps();
+	size_t n = 0;
+	for(; n + 4 <= N; n += 4){
+		__m128 v = _mm_loadu_ps(src + n);
+		p = _mm_max_ps(p, _mm_and_ps(v, mask));
+		s = _mm_add_ps(s, _mm_mul_ps(v, v));
+	}
+	float lanes[4], squares[4];
+	_mm_storeu_ps(lanes, p);
+	_mm_storeu_ps(squares, s);
+	float pk = 0.0f;
+	float sum = 0.0f;
+	for(int k = 0; k < 4; ++k){
+		pk = pk < lanes[k] ? lanes[k] : pk;
+		sum += squares[k];
+	}
+	for(; n < N; ++n){
+		float mag = src[n] < 0.0f ? -src[n] : src[n];
+		pk = pk < mag ? mag : pk;
+		sum += src[n] * src[n];
+	}
+	*peak = pk;
+	*sumOfSquares = sum;
+}
+
+__attribute__((target("sse2")))
+static void deinterleave_sse2(const float* src, float* const* dest, size_t channels, size_t frames){
+	size_t n = 0;
+	if(channels == 2){
+		// four stereo frames are two vectors, the even lanes are left and the odd right
+		float* l = dest[0];
+		float* r = dest[1];
+		for(; n + 4 <= frames; n += 4){
+			__m128 a = _mm_loadu_ps(src + 2 * n);
+			__m128 b = _mm_loadu_ps(src + 2 * n + 4);
+			_mm_storeu_ps(l + n, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+			_mm_storeu_ps(r + n, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+		}
+	} else if(channels % 4 == 0){
+		// four frames of four channels at a time is a 4x4 transpose
+		for(; n + 4 <= frames; n += 4){
+			const float* s = src + n * channels;
+			for(size_t c = 0; c < channels; c += 4){
+				__m128 f0 = _mm_loadu_ps(s + c);
+				__m128 f1 = _mm_loadu_ps(s + channels + c);
+				__m128 f2 = _mm_loadu_ps(s + 2 * channels + c);
+				__m128 f3 = _mm_loadu_ps(s + 3 * channels + c);
+				_MM_TRANSPOSE4_PS(f0, f1, f2, f3);
+				_mm_storeu_ps(dest[c] + n, f0);
+				_mm_storeu_ps(dest[c + 1] + n, f1);
+				_mm_storeu_ps(dest[c + 2] + n, f2);
+				_mm_storeu_ps(dest[c + 3] + n, f3);
+			}
+		}
+	}
+	for(; n < frames; ++n){
+		for(size_t c = 0; c < channels; ++c){
+			dest[c][n] = src[n * channels + c];
+		}
+	}
+}
+
+// -------------------------------------------- avx2
+
+__attribute__((target("avx2")))
+static void copy_with_gain_avx2(const float* src, float* dest, size_t N, float gain){
+	__m256 g = _mm256_set1_ps(gain);
+	size_t n = 0;
+	if(is_aligned(src, dest, 32)){
+		for(; n + 8 <= N; n += 8){
+			_mm256_store_ps(dest + n, _mm256_mul_ps(_mm256_load_ps(src + n), g));
+		}
+	} else {
+		for(; n + 8 <= N; n += 8){
+			_mm256_storeu_ps(dest + n, _mm256_mul_ps(_mm256_loadu_ps(src + n), g));
+		}
+	}
+	for(; n < N; ++n){
+		dest[n] = src[n] * gain;
+	}
+}
+__attribute__((target("avx2")))
+static void sum_with_gain_avx2(const float* src, float* dest, size_t N, float gain){
+	__m256 g = _mm256_set1_ps(gain);
+	size_t n = 0;
+	if(is_aligned(src, dest, 32)){
+		for(; n + 8 <= N; n += 8){
+			_mm256_store_ps(dest + n, _mm256_add_ps(_mm256_load_ps(dest + n), _mm256_mul_ps(_mm256_load_ps(src + n), g)));
+		}
+	} else {
+		for(; n + 8 <= N; n += 8){
+			_mm256_storeu_ps(dest + n, _mm256_add_ps(_mm256_loadu_ps(dest + n), _mm256_mul_ps(_mm256_loadu_ps(src + n), g)));
+		}
+	}
+	for(; n < N; ++n){
+		dest[n] += src[n] * gain;
+	}
+}
+__attribute__((target("avx2")))
+static void sum_with_gain_linear_interp_avx2(const float* src, float* dest, size_t N, float gain, float oldGain, size_t interpSize){
+	if(interpSize > N) interpSize = N;
+	float step = (gain - oldGain) / (float)interpSize;
+	__m256 index = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+	__m256 width = _mm256_set1_ps(8.0f);
+	__m256 s = _mm256_set1_ps(step);
+	__m256 o = _mm256_set1_ps(oldGain);
+	size_t n = 0;
+	for(; n + 8 <= interpSize; n += 8){
+		__m256 g = _mm256_add_ps(o, _mm256_mul_ps(s, index));
+		_mm256_storeu_ps(dest + n, _mm256_add_ps(_mm256_loadu_ps(dest + n), _mm256_mul_ps(_mm256_loadu_ps(src + n), g)));
+		index = _mm256_add_ps(index, width);
+	}
+	for(; n < interpSize; ++n){
+		dest[n] += src[n] * (oldGain + step * (float)n);
+	}
+	sum_with_gain_avx2(src + n, dest + n, N - n, gain);
+}
+
+__attribute__((target("avx2")))
+static void mix_avx2(const MixTerm* terms, size_t count, float* dest, size_t offset, size_t begin, size_t end, size_t rampEnd){
+	float* d = dest + offset;
+	size_t rampStop = rampEnd < end ? rampEnd : end;
+	size_t n = begin;
+	__m256 iota = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+	for(; n + 8 <= rampStop; n += 8){
+		__m256 index = _mm256_add_ps(_mm256_set1_ps((float)n), iota);
+		__m256 acc = _mm256_loadu_ps(d + n);
+		for(size_t k = 0; k < count; ++k){
+			__m256 i = _mm256_min_ps(index, _mm256_set1_ps(terms[k].rampFrames));
+			__m256 g = _mm256_add_ps(_mm256_set1_ps(terms[k].start), _mm256_mul_ps(_mm256_set1_ps(terms[k].step), i));
+			acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(terms[k].src + offset + n), g));
+		}
+		_mm256_storeu_ps(d + n, acc);
+	}
+	for(; n < rampStop; ++n){
+		mix_ramp_frame(terms, count, d, offset, n);
+	}
+	// four vectors of frames per pass, each term is fetched once for all of them
+	for(; n + 32 <= end; n += 32){
+		__m256 a0 = _mm256_loadu_ps(d + n);
+		__m256 a1 = _mm256_loadu_ps(d + n + 8);
+		__m256 a2 = _mm256_loadu_ps(d + n + 16);
+		__m256 a3 = _mm256_loadu_ps(d + n + 24);
+		for(size_t k = 0; k < count; ++k){
+			const float* s = terms[k].src + offset + n;
+			__m256 g = _mm256_set1_ps(terms[k].gain);
+			a0 = _mm256_add_ps(a0, _mm256_mul_ps(_mm256_loadu_ps(s), g));
+			a1 = _mm256_add_ps(a1, _mm256_mul_ps(_mm256_loadu_ps(s + 8), g));
+			a2 = _mm256_add_ps(a2, _mm256_mul_ps(_mm256_loadu_ps(s + 16), g));
+			a3 = _mm256_add_ps(a3, _mm256_mul_ps(_mm256_loadu_ps(s + 24), g));
+		}
+		_mm256_storeu_ps(d + n, a0);
+		_mm256_storeu_ps(d + n + 8, a1);
+		_mm256_storeu_ps(d + n + 16, a2);
+		_mm256_storeu_ps(d + n + 24, a3);
+	}
+	for(; n + 8 <= end; n += 8){
+		__m256 acc = _mm256_loadu_ps(d + n);
+		for(size_t k = 0; k < count; ++k){
+			acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(terms[k].src + offset + n), _mm256_set1_ps(terms[k].gain)));
+		}
+		_mm256_storeu_ps(d + n, acc);
+	}
+	for(; n < end; ++n){
+		mix_frame(terms, count, d, offset, n);
+	}
+}
+
+__attribute__((target("avx2")))
+static void peak_and_squares_avx2(const float* src, size_t N, float* peak, float* sumOfSquares){
+	__m256 mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	__m256 p = _mm256_setzero_ps();
+	__m256 s = _mm256_setzero_ps();
+	size_t n = 0;
+	for(; n + 8 <= N; n += 8){
+		__m256 v = _mm256_loadu_ps(src + n);
+		p = _mm256_max_ps(p, _mm256_and_ps(v, mask));
+		s = _mm256_add_ps(s, _mm256_mul_ps(v, v));
+	}
+	float lanes[8], squares[8];
+	_mm256_storeu_ps(lanes, p);
+	_mm256_storeu_ps(squares, s);
+	float pk = 0.0f;
+	float sum = 0.0f;
+	for(int k = 0; k < 8; ++k){
+		pk = pk < lanes[k] ? lanes[k] : pk;
+		sum += squares[k];
+	}
+	for(; n < N; ++n){
+		float mag = src[n] < 0.0f ? -src[n] : src[n];
+		pk = pk < mag ? mag : pk;
+		sum += src[n] * src[n];
+	}
+	*peak = pk;
+	*sumOfSquares = sum;
+}
+
+// -------------------------------------------- avx512
+
+/// lanes [0, count) of a 16 lane mask, count must be below 16
+static inline __mmask16 tail_mask(size_t count){
+	return (__mmask16)((1u << count) - 1u);
+}
+
+__attribute__((target("avx512f")))
+static void copy_with_gain_avx512(const float* src, float* dest, size_t N, float gain){
+	__m512 g = _mm512_set1_ps(gain);
+	size_t n = 0;
+	if(is_aligned(src, dest, 64)){
+		for(; n + 16 <= N; n += 16){
+			_mm512_store_ps(dest + n, _mm512_mul_ps(_mm512_load_ps(src + n), g));
+		}
+	} else {
+		for(; n + 16 <= N; n += 16){
+			_mm512_storeu_ps(dest + n, _mm512_mul_ps(_mm512_loadu_ps(src + n), g));
+		}
+	}
+	if(n < N){
+		// masked tail rather than a scalar loop
+		__mmask16 m = tail_mask(N - n);
+		_mm512_mask_storeu_ps(dest + n, m, _mm512_mul_ps(_mm512_maskz_loadu_ps(m, src + n), g));
+	}
+}
+__attribute__((target("avx512f")))
+static void sum_with_gain_avx512(const float* src, float* dest, size_t N, float gain){
+	__m512 g = _mm512_set1_ps(gain);
+	size_t n = 0;
+	if(is_aligned(src, dest, 64)){
+		for(; n + 16 <= N; n += 16){
+			_mm512_store_ps(dest + n, _mm512_add_ps(_mm512_load_ps(dest + n), _mm512_mul_ps(_mm512_load_ps(src + n), g)));
+		}
+	} else {
+		for(; n + 16 <= N; n += 16){
+			_mm512_storeu_ps(dest + n, _mm512_add_ps(_mm512_loadu_ps(dest + n), _mm512_mul_ps(_mm512_loadu_ps(src + n), g)));
+		}
+	}
+	if(n < N){
+		__mmask16 m = tail_mask(N - n);
+		__m512 d = _mm512_maskz_loadu_ps(m, dest + n);
+		_mm512_mask_storeu_ps(dest + n, m, _mm512_add_ps(d, _mm512_mul_ps(_mm512_maskz_loadu_ps(m, src + n), g)));
+	}
+}
+__attribute__((target("avx512f")))
+static void sum_with_gain_linear_interp_avx512(const float* src, float* dest, size_t N, float gain, float oldGain, size_t interpSize){
+	if(interpSize > N) interpSize = N;
+	float step = (gain - oldGain) / (float)interpSize;
+	__m512 index = _mm512_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f,
+			8.0f, 9.0f, 10.0f, 11.0f, 12.0f, 13.0f, 14.0f, 15.0f);
+	__m512 width = _mm512_set1_ps(16.0f);
+	__m512 s = _mm512_set1_ps(step);
+	__m512 o = _mm512_set1_ps(oldGain);
+	size_t n = 0;
+	for(; n + 16 <= interpSize; n += 16){
+		__m512 g = _mm512_add_ps(o, _mm512_mul_ps(s, index));
+		_mm512_storeu_ps(dest + n, _mm512_add_ps(_mm512_loadu_ps(dest + n), _mm512_mul_ps(_mm512_loadu_ps(src + n), g)));
+		index = _mm512_add_ps(index, width);
+	}
+	if(n < interpSize){
+		__mmask16 m = tail_mask(interpSize - n);
+		__m512 g = _mm512_add_ps(o, _mm512_mul_ps(s, index));
+		__m512 d = _mm512_maskz_loadu_ps(m, dest + n);
+		_mm512_mask_storeu_ps(dest + n, m, _mm512_add_ps(d, _mm512_mul_ps(_mm512_maskz_loadu_ps(m, src + n), g)));
+		n = interpSize;
+	}
+	sum_with_gain_avx512(src + n, dest + n, N - n, gain);
+}
+
+__attribute__((target("avx512f")))
+static void mix_avx512(const MixTerm* terms, size_t count, float* dest, size_t offset, size_t begin, size_t end, size_t rampEnd){
+	float* d = dest + offset;
+	size_t rampStop = rampEnd < end ? rampEnd : end;
+	size_t n = begin;
+	__m512 iota = _mm512_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f,
+			8.0f, 9.0f, 10.0f, 11.0f, 12.0f, 13.0f, 14.0f, 15.0f);
+	for(; n + 16 <= rampStop; n += 16){
+		__m512 index = _mm512_add_ps(_mm512_set1_ps((float)n), iota);
+		__m512 acc = _mm512_loadu_ps(d + n);
+		for(size_t k = 0; k < count; ++k){
+			// every lane masked in, the unmasked form passes gcc an undefined vector it warns about
+			__m512 i = _mm512_mask_min_ps(index, 0xffff, index, _mm512_set1_ps(terms[k].rampFrames));
+			__m512 g = _mm512_add_ps(_mm512_set1_ps(terms[k].start), _mm512_mul_ps(_mm512_set1_ps(terms[k].step), i));
+			acc = _mm512_add_ps(acc, _mm512_mul_ps(_mm512_loadu_ps(terms[k].src + offset + n), g));
+		}
+		_mm512_storeu_ps(d + n, acc);
+	}
+	for(; n < rampStop; ++n){
+		mix_ramp_frame(terms, count, d, offset, n);
+	}
+	// four vectors of frames per pass, each term is fetched once for all of them
+	for(; n + 64 <= end; n += 64){
+		__m512 a0 = _mm512_loadu_ps(d + n);
+		__m512 a1 = _mm512_loadu_ps(d + n + 16);
+		__m512 a2 = _mm512_loadu_ps(d + n + 32);
+		__m512 a3 = _mm512_loadu_ps(d + n + 48);
+		for(size_t k = 0; k < count; ++k){
+			const float* s = terms[k].src + offset + n;
+			__m512 g = _mm512_set1_ps(terms[k].gain);
+			a0 = _mm512_add_ps(a0, _mm512_mul_ps(_mm512_loadu_ps(s), g));
+			a1 = _mm512_add_ps(a1, _mm512_mul_ps(_mm512_loadu_ps(s + 16), g));
+			a2 = _mm512_add_ps(a2, _mm512_mul_ps(_mm512_loadu_ps(s + 32), g));
+			a3 = _mm512_add_ps(a3, _mm512_mul_ps(_mm512_loadu_ps(s + 48), g));
+		}
+		_mm512_storeu_ps(d + n, a0);
+		_mm512_storeu_ps(d + n + 16, a1);
+		_mm512_storeu_ps(d + n + 32, a2);
+		_mm512_storeu_ps(d + n + 48, a3);
+	}
+	for(; n + 16 <= end; n += 16){
+		__m512 acc = _mm512_loadu_ps(d + n);
+		for(size_t k = 0; k < count; ++k){
+			acc = _mm512_add_ps(acc, _mm512_mul_ps(_mm512_loadu_ps(terms[k].src + offset + n), _mm512_set1_ps(terms[k].gain)));
+		}
+		_mm512_storeu_ps(d + n, acc);
+	}
+	for(; n < end; ++n){
+		mix_frame(terms, count, d, offset, n);
+	}
+}
+
+__attribute__((target("avx512f")))
+static void peak_and_squares_avx512(const float* src, size_t N, float* peak, float* sumOfSquares){
+	__m512i mask = _mm512_set1_epi32(0x7fffffff);
+	__m512 p = _mm512_setzero_ps();
+	__m512 s = _mm512_setzero_ps();
+	size_t n = 0;
+	for(; n + 16 <= N; n += 16){
+		__m512 v = _mm512_loadu_ps(src + n);
+		__m512 mag = _mm512_castsi512_ps(_mm512_and_epi32(_mm512_castps_si512(v), mask));
+		p = _mm512_mask_max_ps(p, 0xffff, p, mag);
+		s = _mm512_add_ps(s, _mm512_mul_ps(v, v));
+	}
+	if(n < N){
+		// the masked off lanes load as zero, which changes neither figure
+		__m512 v = _mm512_maskz_loadu_ps(tail_mask(N - n), src + n);
+		__m512 mag = _mm512_castsi512_ps(_mm512_and_epi32(_mm512_castps_si512(v), mask));
+		p = _mm512_mask_max_ps(p, 0xffff, p, mag);
+		s = _mm512_add_ps(s, _mm512_mul_ps(v, v));
+	}
+	float lanes[16], squares[16];
+	_mm512_storeu_ps(lanes, p);
+	_mm512_storeu_ps(squares, s);
+	float pk = 0.0f;
+	float sum = 0.0f;
+	for(int k = 0; k < 16; ++k){
+		pk = pk < lanes[k] ? lanes[k] : pk;
+		sum += squares[k];
+	}
+	*peak = pk;
+	*sumOfSquares = sum;
+}
+
+#endif
+
+// -------------------------------------------- dispatch
+
+static const DspKernels s_kernels[] = {
+#ifdef RESOUND_X86_KERNELS
+	{ "avx512", copy_with_gain_avx512, sum_with_gain_avx512, sum_with_gain_linear_interp_avx512, mix_avx512, peak_and_squares_avx512, deinterleave_sse2 },
+	{ "avx2", copy_with_gain_avx2, sum_with_gain_avx2, sum_with_gain_linear_interp_avx2, mix_avx2, peak_and_squares_avx2, deinterleave_sse2 },
+	{ "sse2", copy_with_gain_sse2, sum_with_gain_sse2, sum_with_gain_linear_interp_sse2, mix_sse2, peak_and_squares_sse2, deinterleave_sse2 },
+#endif
+	{ "scalar", copy_with_gain_scalar, sum_with_gain_scalar, sum_with_gain_linear_interp_scalar, mix_scalar, peak_and_squares_scalar, deinterleave_scalar }
+};
+static const size_t s_kernelCount = sizeof(s_kernels) / sizeof(s_kernels[0]);
+
+DspKernels g_dspKernels = { "scalar", copy_with_gain_scalar, sum_with_gain_scalar, sum_with_gain_linear_interp_scalar, mix_scalar, peak_and_squares_scalar, deinterleave_scalar };
+
+/// true if this cpu and the os can run a set of kernels
+static bool kernels_supported(const std::string& name){
+	if(name == "scalar") return true;
+#ifdef RESOUND_X86_KERNELS
+	__builtin_cpu_init();
+	if(name == "sse2") return __builtin_cpu_supports("sse2");
+	if(name == "avx2") return __builtin_cpu_supports("avx2");
+	if(name == "avx512") return __builtin_cpu_supports("avx512f");
+#endif
+	return false;
+}
+
+bool dsp_select_kernels(const std::string& name){
+	for(size_t n = 0; n < s_kernelCount; ++n){
+		// the table runs from the widest down so auto takes the first the cpu can run
+		if(name != "auto" && name != s_kernels[n].name) continue;
+		if(kernels_supported(s_kernels[n].name)){
+			g_dspKernels = s_kernels[n];
+			return true;
+		}
+		if(name != "auto") return false;
+	}
+	return false;
+}
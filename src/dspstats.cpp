@@ -0,0 +1,107 @@
+//    Resound
+//    Copyright 2009 David Moore and James Mooney
+//
+//    This file is part of Resound.
+//
+//    Resound is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    Resound is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Resound; if not, write to the Free Software
+//    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include "resoundnv/dspstats.hpp"
+#include <algorithm>
+#include <unistd.h>
+
+double dsp_cycles_per_usec(){
+	static double cyclesPerUsec = 0.0;
+	if(cyclesPerUsec == 0.0){
+#if defined(__i386__) || defined(__x86_64__)
+		// measure the time stamp counter against the monotonic clock
+		struct timespec a, b;
+		clock_gettime(CLOCK_MONOTONIC, &a);
+		dsp_cycles_t start = dsp_read_cycles();
+		usleep(20000);
+		dsp_cycles_t end = dsp_read_cycles();
+		clock_gettime(CLOCK_MONOTONIC, &b);
+		double usec = (b.tv_sec - a.tv_sec) * 1000000.0 + (b.tv_nsec - a.tv_nsec) / 1000.0;
+		cyclesPerUsec = (end - start) / usec;
+#else
+		cyclesPerUsec = 1000.0;
+#endif
+	}
+	return cyclesPerUsec;
+}
+
+// -------------------------------------------- DspTimer
+
+DspTimer::DspTimer(const std::string& name) :
+		name_(name),
+		current_(0),
+		count_(0)
+{
+	for(unsigned int n = 0; n < HISTORY; ++n) history_[n] = 0;
+}
+
+void DspTimer::summarise(DspTimerSummary& summary) const {
+	summary.name = name_;
+	unsigned int count = count_;
+	__sync_synchronize();
+	unsigned int blocks = std::min(count, HISTORY);
+	std::vector<uint32_t> samples(history_, history_ + blocks);
+	summary.blocks = blocks;
+	if(blocks == 0){
+		summary.min = summary.mean = summary.max = summary.p99 = 0.0f;
+		return;
+	}
+	std::sort(samples.begin(), samples.end());
+	double total = 0.0;
+	for(unsigned int n = 0; n < blocks; ++n) total += samples[n];
+	double scale = 1.0 / dsp_cycles_per_usec();
+	summary.min = samples.front() * scale;
+	summary.max = samples.back() * scale;
+	summary.mean = total / blocks * scale;
+	summary.p99 = samples[(blocks - 1) * 99 / 100] * scale;
+}
+
+// -------------------------------------------- DspStats
+
+DspStats::DspStats() :
+		blockStart_(0)
+{
+	block_ = add_timer(this, "block");
+	dsp_cycles_per_usec(); // calibrate now rather than on the first query
+}
+
+DspStats::~DspStats(){
+	for(unsigned int n = 0; n < timers_.size(); ++n){
+		delete timers_[n];
+	}
+}
+
+DspTimer* DspStats::add_timer(const void* object, const std::string& name){
+	DspTimer* timer = new DspTimer(name);
+	timers_.push_back(timer);
+	objects_[object] = timer;
+	return timer;
+}
+
+DspTimer* DspStats::get_timer(const void* object){
+	TimerMap::iterator it = objects_.find(object);
+	return it == objects_.end() ? 0 : it->second;
+}
+
+void DspStats::summarise(std::vector<DspTimerSummary>& summaries) const {
+	summaries.resize(timers_.size());
+	for(unsigned int n = 0; n < timers_.size(); ++n){
+		timers_[n]->summarise(summaries[n]);
+	}
+}
@@ -25,43 +25,59 @@ m_jack(jack),
 m_port(0),
 m_flags(flags){
 	assert(m_jack);
+	if(m_jack->m_offline){
+		m_buffer.resize(m_jack->m_bufferSize, 0.0f);
+		m_name = id;
+		return;
+	}
 	m_port = jack_port_register(m_jack->m_jc,id.c_str(),JACK_DEFAULT_AUDIO_TYPE,flags,0);
 	assert(m_port);
 	m_name = jack_port_name(m_port);
 }
 JackPort::~JackPort(){
-	jack_port_unregister(m_jack->m_jc,m_port);
+	if(m_port) jack_port_unregister(m_jack->m_jc,m_port);
 }
 float* JackPort::get_audio_buffer(jack_nframes_t nframes){
+	if(!m_port) return &m_buffer[0];
 	return (float*)jack_port_get_buffer(m_port, nframes);
 }
 
 void JackPort::connect(std::string portName){
-	if(m_flags & JackPortIsInput){
+	if(!m_port){
+		// offline, only remember it
+	} else if(m_flags & JackPortIsInput){
 		jack_connect(m_jack->m_jc,portName.c_str(),m_name.c_str());
 		std::cout << "JackPort connecting "<<portName<<" -> "<<m_name<<"\n";
 	} else {
 		jack_connect(m_jack->m_jc,m_name.c_str(),portName.c_str());
 		std::cout << "JackPort connecting "<<m_name<<" -> "<<portName<<"\n";
 	}
+	m_connections.push_back(portName);
 }
 void JackPort::disconnect(std::string portName){
-	if(m_flags & JackPortIsInput){
+	if(!m_port){
+		// offline, only forget it
+	} else if(m_flags & JackPortIsInput){
 		jack_disconnect(m_jack->m_jc,portName.c_str(),m_name.c_str());
 		std::cout << "JackPort disconnecting "<<portName<<" -> "<<m_name<<"\n";
 	} else {
 		jack_disconnect(m_jack->m_jc,m_name.c_str(),portName.c_str());
 		std::cout << "JackPort disconnecting "<<m_name<<" -> "<<portName<<"\n";
 	}
+	m_connections.remove(portName);
 }
 void JackPort::disconnect_all(){
-	jack_port_disconnect(m_jack->m_jc,m_port);
+	if(m_port) jack_port_disconnect(m_jack->m_jc,m_port);
+	m_connections.clear();
 }
 // -------------------------------------------- JackEngine
 
 JackEngine::JackEngine()
 {	
+	m_jc = 0;
 	m_dspIsRunning = false;
+	m_offline = false;
+	m_frameTime = 0;
 }
 
 JackEngine::~JackEngine(){
@@ -80,22 +96,44 @@ void JackEngine::init(const std::string name){
 	jack_set_process_callback(m_jc,JackEngine::jack_process_callback,this);
 	jack_set_thread_init_callback(m_jc,JackEngine::jack_thread_init_callback,this);
 	jack_set_xrun_callback(m_jc,JackEngine::jack_xrun_callback,this);
+	jack_on_shutdown(m_jc,JackEngine::jack_shutdown_callback,this);
 	// get some info from jackd about current SR and bufferSize;
 	m_bufferSize = jack_get_buffer_size(m_jc);
 	m_sampleRate = jack_get_sample_rate(m_jc);
 
 	this->on_init();
 }
+void JackEngine::init_offline(const std::string name, jack_nframes_t bufferSize, jack_nframes_t sampleRate){
+	m_name = name;
+	m_jc = 0;
+	m_offline = true;
+	m_frameTime = 0;
+	m_bufferSize = bufferSize;
+	m_sampleRate = sampleRate;
+
+	this->on_init();
+}
+int JackEngine::process_offline(){
+	assert(m_offline);
+	int ret = on_process(m_bufferSize);
+	m_frameTime += m_bufferSize;
+	return ret;
+}
 void JackEngine::start(){
-	assert(m_jc);
-	jack_activate(m_jc);
-	m_dspIsRunning = true;
+	// offline the owner drives processing itself, no other thread is ever running the dsp
+	if(!m_offline){
+		assert(m_jc);
+		jack_activate(m_jc);
+		m_dspIsRunning = true;
+	}
 	this->on_start();
 }
 void JackEngine::stop(){
-	assert(m_jc);
-	jack_deactivate(m_jc);
-	m_dspIsRunning = false;
+	if(!m_offline){
+		assert(m_jc);
+		jack_deactivate(m_jc);
+		m_dspIsRunning = false;
+	}
 	this->on_stop();
 }
 void JackEngine::close(){
@@ -108,6 +146,7 @@ void JackEngine::close(){
 int JackEngine::jack_buffer_size_callback(jack_nframes_t nframes, void *arg){
 	JackEngine* ptr = static_cast<JackEngine*>(arg);
 	assert(ptr);
+	ptr->m_bufferSize = nframes; // objects built from now on are sized for it
 	return ptr->on_buffer_size(nframes);
 }
 
@@ -164,7 +203,14 @@ int JackEngine::jack_xrun_callback(void *arg){
 	return ptr->on_xrun();
 }
 
+int JackEngine::create_thread(pthread_t* thread, void *(*func)(void*), void* arg){
+	if(m_offline) return pthread_create(thread, 0, func, arg);
+	assert(m_jc);
+	return jack_client_create_thread(m_jc, thread, jack_client_real_time_priority(m_jc), jack_is_realtime(m_jc), func, arg);
+}
+
 void JackEngine::get_ports(JackPortNameList& portList,const std::string& portNamePattern, const std::string& typeNamePattern){
+	if(m_offline) return;
 	const char** ports = jack_get_ports(m_jc,portNamePattern.c_str(),typeNamePattern.c_str(),0);
 	if(ports){	
 		for(int n = 0; ports[n] != 0; n++){
@@ -175,5 +221,10 @@ void JackEngine::get_ports(JackPortNameList& portList,const std::string& portNam
 
 }
 
-
-
+void JackEngine::jack_shutdown_callback(void *arg){
+	JackEngine* ptr = static_cast<JackEngine*>(arg);
+	assert(ptr);
+	// anything waiting on the process callback must stop waiting
+	ptr->m_dspIsRunning = false;
+	ptr->on_shutdown();
+}
@@ -0,0 +1,75 @@
+//    Resound
+//    Copyright 2009 David Moore and James Mooney
+//
+//    This file is part of Resound.
+//
+//    Resound is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    Resound is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Resound; if not, write to the Free Software
+//    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+#include "resoundnv/meterbank.hpp"
+
+MeterBank::MeterBank() :
+		back_(0),
+		middle_(1),
+		front_(2)
+{}
+
+void MeterBank::add(const std::string& name, AudioBuffer* buffer, VUMeter* meter, bool bus){
+	Channel c;
+	c.name = name;
+	c.buffer = buffer;
+	c.meter = meter;
+	c.bus = bus;
+	channels_.push_back(c);
+}
+
+void MeterBank::finalise(int windowFrames){
+	MeterReading zero = { 0.0f, 0.0f, 0.0f };
+	for(int n = 0; n < 3; ++n){
+		slots_[n].assign(channels_.size(), zero);
+	}
+	for(unsigned int n = 0; n < channels_.size(); ++n){
+		channels_[n].meter->set_window(windowFrames);
+	}
+}
+
+void MeterBank::process(jack_nframes_t nframes){
+	if(channels_.empty()) return;
+	MeterReading* out = &slots_[back_][0];
+	for(unsigned int n = 0; n < channels_.size(); ++n){
+		Channel& c = channels_[n];
+		if(c.bus && c.buffer->is_silent()){
+			c.meter->analyse_silence(nframes);
+		} else {
+			float peak, sumOfSquares;
+			ab_peak_and_squares(c.buffer->get_buffer(), nframes, peak, sumOfSquares);
+			// an aliased livestream holds its samples before its gain
+			float gain = c.buffer->get_read_gain();
+			c.meter->analyse_block(peak * std::abs(gain), sumOfSquares * gain * gain, nframes);
+		}
+		out[n].rms = c.meter->get_rms();
+		out[n].peak = c.meter->get_peak();
+		out[n].margin = c.meter->get_margin();
+	}
+	// the readings before the slot index
+	__sync_synchronize();
+	back_ = __sync_lock_test_and_set(&middle_, back_ | FRESH) & ~FRESH;
+}
+
+bool MeterBank::read(const MeterReading*& readings){
+	if(channels_.empty() || !(middle_ & FRESH)) return false;
+	front_ = __sync_lock_test_and_set(&middle_, front_) & ~FRESH;
+	__sync_synchronize(); // the slot index before the readings
+	readings = &slots_[front_][0];
+	return true;
+}
@@ -0,0 +1,156 @@
+//    Resound
+//    Copyright 2009 David Moore and James Mooney
+//
+//    This file is part of Resound.
+//
+//    Resound is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    Resound is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Resound; if not, write to the Free Software
+//    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include "resoundnv/mixmatrix.hpp"
+#include "resoundnv/core.hpp"
+
+bool MixMatrix::can_mix(const BehaviourVector& behaviours, const AudioBufferSet& buses){
+	for(unsigned int n = 0; n < behaviours.size(); ++n){
+		AudioBufferSet reads, writes;
+		behaviours[n]->get_buffer_usage(reads, writes);
+		for(AudioBufferSet::iterator it = reads.begin(); it != reads.end(); ++it){
+			if(buses.count(*it)) return false;
+		}
+	}
+	return true;
+}
+
+MixMatrix::MixMatrix(const BehaviourVector& behaviours) :
+		rampEnd_(0)
+{
+	set_id("mixmatrix");
+
+	// collect the routes in the order the behaviours sum them, noting the bus of each
+	std::vector<AudioBuffer*> buses;
+	std::map<AudioBuffer*, std::vector<size_t> > busEntries;
+	for(unsigned int b = 0; b < behaviours.size(); ++b){
+		if(!behaviours[b]->supports_mix_matrix()) continue;
+		RouteSetBehaviour* behaviour = dynamic_cast<RouteSetBehaviour*>(behaviours[b]);
+		if(!behaviour) continue;
+		mixed_.insert(behaviour);
+		RouteSetBehaviour::BRouteSetArray& routeSets = behaviour->get_route_sets();
+		for(unsigned int s = 0; s < routeSets.size(); ++s){
+			BRouteRange routes = routeSets[s]->get_routes();
+			for(unsigned int n = 0; n < routes.size(); ++n){
+				Entry e;
+				e.route = &routes[n];
+				e.term = 0;
+				AudioBuffer* bus = routes[n].get_to();
+				if(busEntries.find(bus) == busEntries.end()) buses.push_back(bus);
+				busEntries[bus].push_back(entries_.size());
+				entries_.push_back(e);
+			}
+		}
+	}
+
+	// lay the terms out a bus at a time
+	terms_.resize(entries_.size());
+	sources_.resize(entries_.size());
+	active_.resize(entries_.size());
+	for(unsigned int b = 0; b < buses.size(); ++b){
+		std::vector<size_t>& indices = busEntries[buses[b]];
+		Column c;
+		c.bus = buses[b];
+		c.first = columns_.empty() ? 0 : columns_.back().last;
+		c.last = c.first + indices.size();
+		c.activeLast = c.first;
+		c.lane = 0;
+		for(unsigned int n = 0; n < indices.size(); ++n){
+			Entry& e = entries_[indices[n]];
+			e.term = c.first + n;
+			MixTerm& t = terms_[e.term];
+			sources_[e.term] = e.route->get_from();
+			t.src = e.route->get_from()->get_buffer();
+			t.start = 0.0f;
+			t.step = 0.0f;
+			t.gain = 0.0f;
+			t.rampFrames = 0.0f;
+		}
+		columns_.push_back(c);
+	}
+}
+
+void MixMatrix::process(jack_nframes_t offset, jack_nframes_t nframes){
+	process_control(offset, nframes);
+	process_lane(offset, nframes, ALL_LANES);
+}
+
+void MixMatrix::get_buffer_usage(AudioBufferSet& reads, AudioBufferSet& writes){
+	Behaviour::get_buffer_usage(reads, writes);
+	for(unsigned int n = 0; n < entries_.size(); ++n){
+		reads.insert(entries_[n].route->get_from());
+	}
+	for(unsigned int n = 0; n < columns_.size(); ++n){
+		writes.insert(columns_[n].bus);
+	}
+}
+
+void MixMatrix::assign_bus_lanes(const BusLaneMap& lanes){
+	for(unsigned int n = 0; n < columns_.size(); ++n){
+		BusLaneMap::const_iterator it = lanes.find(columns_[n].bus);
+		columns_[n].lane = it != lanes.end() ? it->second : 0;
+	}
+}
+
+void MixMatrix::process_control(jack_nframes_t offset, jack_nframes_t nframes){
+	// each route ramps on from where it was, a behaviour carried over from the last program included
+	rampEnd_ = 0;
+	for(unsigned int n = 0; n < entries_.size(); ++n){
+		Entry& e = entries_[n];
+		MixTerm& t = terms_[e.term];
+		// an aliased source moves with the block
+		t.src = e.route->get_from()->get_buffer();
+		size_t frames = e.route->advance_level(nframes, t.start, t.step);
+		t.rampFrames = (float)frames;
+		t.gain = t.start + t.step * t.rampFrames;
+		if(frames > rampEnd_) rampEnd_ = frames;
+	}
+}
+
+void MixMatrix::process_lane(jack_nframes_t offset, jack_nframes_t nframes, int lane){
+	// a silent source or a route at zero and staying there adds nothing.
+	// the sources are only known to be written once the lane runs, not at control rate
+	for(unsigned int n = 0; n < columns_.size(); ++n){
+		Column& c = columns_[n];
+		if(lane != ALL_LANES && lane != c.lane) continue;
+		size_t active = c.first;
+		for(size_t i = c.first; i < c.last; ++i){
+			const MixTerm& t = terms_[i];
+			if(sources_[i]->is_silent()) continue;
+			if(t.start == 0.0f && t.step == 0.0f && t.gain == 0.0f) continue;
+			active_[active++] = t;
+		}
+		c.activeLast = active;
+		if(active > c.first) c.bus->set_silent(false);
+	}
+	const MixTerm* terms = active_.empty() ? 0 : &active_[0];
+	for(size_t begin = 0; begin < nframes; begin += TILE_FRAMES){
+		size_t end = begin + TILE_FRAMES < nframes ? begin + TILE_FRAMES : nframes;
+		for(unsigned int n = 0; n < columns_.size(); ++n){
+			const Column& c = columns_[n];
+			if(lane != ALL_LANES && lane != c.lane) continue;
+			if(c.activeLast == c.first) continue;
+			ab_mix(terms + c.first, c.activeLast - c.first, c.bus->get_buffer(), offset, begin, end, rampEnd_);
+		}
+	}
+}
+
+void MixMatrix::print(){
+	std::cout << "MixMatrix " << entries_.size() << " routes from " << mixed_.size() << " behaviours into " << columns_.size() << " buses" << std::endl;
+}
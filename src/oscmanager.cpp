@@ -20,9 +20,18 @@
 #include "resoundnv/oscmanager.hpp"
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
 #include <iostream>
 
-Resound::OSCManager::OSCManager(const char* port){
+Resound::OSCManager::OSCManager(const char* port) :
+		m_snapshot(new ClientSnapshot),
+		m_readers(0),
+		m_table(new OSCAddressTable(OSCAddressTable::TargetMap(), OSCAddressTable::HandleMap())),
+		m_dispatching(0)
+{
+	pthread_mutex_init(&m_clientLock, NULL);
+	pthread_mutex_init(&m_targetLock, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &m_lastExpiry);
 	// init OSC
 	std::cout << "Initialising OSC listen thread... \n";
 	m_loServerThread = lo_server_thread_new(port, Resound::OSCManager::lo_cb_error);
@@ -32,6 +41,12 @@ Resound::OSCManager::OSCManager(const char* port){
    // lo_server_thread_add_method(m_loServerThread, NULL, NULL, lo_cb_generic, this); // debugging
 	lo_server_thread_add_method(m_loServerThread, "/syn", NULL, lo_cb_syn, this);
 	lo_server_thread_add_method(m_loServerThread, "/ack", NULL, lo_cb_ack, this);
+	// parameters share one catch all method, liblo tries the methods in turn so the fixed ones stay few
+	lo_server_thread_add_method(m_loServerThread, NULL, NULL, lo_cb_dispatch, this);
+	lo_server_thread_add_method(m_loServerThread, "/resound/params", NULL, lo_cb_batch, this);
+	lo_server_thread_add_method(m_loServerThread, "/resound/params/handles", NULL, lo_cb_handles, this);
+	// dispatch bundles as soon as they arrive, timetags are honoured sample accurately by the dsp thread
+	lo_server_enable_queue(lo_server_thread_get_server(m_loServerThread), 0, 1);
 	// start
 	lo_server_thread_start(m_loServerThread);
 
@@ -40,9 +55,23 @@ Resound::OSCManager::OSCManager(const char* port){
 	std::cout << "Sending self-test OSC messages... \n";
 	lo_address t = lo_address_new(NULL, port);
 	lo_send(t, "/syn", "i", std::atoi(port));
+	lo_address_free(t);
 }
 Resound::OSCManager::~OSCManager(){
 	if(m_loServerThread) {lo_server_thread_free(m_loServerThread);}
+	// nothing is reading once the server thread is gone
+	ClientSnapshot* current = m_snapshot;
+	m_retiredSnapshots.push_back(current);
+	m_snapshot = 0;
+	free_retired();
+	for(ActiveClientMap::iterator it = m_clients.begin(); it != m_clients.end(); ++it){
+		if(it->second.returnAddress) lo_address_free(it->second.returnAddress);
+	}
+	pthread_mutex_destroy(&m_clientLock);
+	for(unsigned int n = 0; n < m_retiredTables.size(); ++n) delete m_retiredTables[n];
+	OSCAddressTable* table = m_table;
+	delete table;
+	pthread_mutex_destroy(&m_targetLock);
 }
 	// liblo callbacks
 
@@ -72,26 +101,106 @@ int Resound::OSCManager::lo_cb_ack(const char *path, const char *types, lo_arg *
     return 1;
 }
 
-void Resound::OSCManager::recv_syn(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data){
-	if(argc > 0){
-		//TODO should really check arg for integer type here
-		std::string url(lo_address_get_url(lo_message_get_source(data)));
-		ActiveClientMap::iterator it = m_clients.find(url);
-		if(it == m_clients.end()){
-			// this is a new client tel the world
-			std::cout << "OSC new client detected at " << url << " on port " << argv[0]->i << "\n";
+int Resound::OSCManager::lo_cb_dispatch(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data){
+	OSCManager* manager = static_cast<OSCManager*>(user_data);
+	__sync_fetch_and_add(&manager->m_dispatching, 1); // the table is read after the count is up
+	const std::vector<OSCTarget>* targets = manager->m_table->find(path);
+	if(targets){
+		for(unsigned int n = 0; n < targets->size(); ++n){
+			(*targets)[n].handler(path, types, argv, argc, data, (*targets)[n].userData);
+		}
+	}
+	__sync_fetch_and_sub(&manager->m_dispatching, 1);
+	// handled, or left for the liblo methods
+	return targets ? 0 : 1;
+}
+
+int Resound::OSCManager::lo_cb_batch(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data){
+	OSCManager* manager = static_cast<OSCManager*>(user_data);
+	// each value goes to its targets as if it came in a message of its own, timetag and all.
+	// untagged they all land in the same block
+	lo_arg value;
+	lo_arg* valueArgs[1] = { &value };
+	__sync_fetch_and_add(&manager->m_dispatching, 1);
+	const OSCAddressTable* table = manager->m_table;
+	if(argc == 1 && types[0] == 'b'){
+		// pairs of big endian int32 handle and float32 value, as osc packs its own arguments
+		const unsigned char* p = (const unsigned char*)lo_blob_dataptr((lo_blob)argv[0]);
+		uint32_t pairs = lo_blob_datasize((lo_blob)argv[0]) / 8;
+		for(uint32_t n = 0; n < pairs; ++n, p += 8){
+			int32_t handle = (int32_t)((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3]);
+			uint32_t bits = (uint32_t)p[4] << 24 | (uint32_t)p[5] << 16 | (uint32_t)p[6] << 8 | p[7];
+			std::memcpy(&value.f, &bits, sizeof(float));
+			const char* address;
+			const std::vector<OSCTarget>* targets = table->find(handle, address);
+			if(!targets) continue;
+			for(unsigned int t = 0; t < targets->size(); ++t){
+				(*targets)[t].handler(address, "f", valueArgs, 1, data, (*targets)[t].userData);
+			}
+		}
+	} else {
+		// or handle value argument pairs, for clients that cannot pack a blob
+		for(int n = 0; n + 1 < argc; n += 2){
+			if(types[n] != 'i' || (types[n + 1] != 'f' && types[n + 1] != 'i')) continue;
+			value.f = types[n + 1] == 'f' ? argv[n + 1]->f : (float)argv[n + 1]->i;
+			const char* address;
+			const std::vector<OSCTarget>* targets = table->find(argv[n]->i, address);
+			if(!targets) continue;
+			for(unsigned int t = 0; t < targets->size(); ++t){
+				(*targets)[t].handler(address, "f", valueArgs, 1, data, (*targets)[t].userData);
+			}
 		}
-		ActiveClient c;
-		c.timeToLive = 5;
-		c.url = url;
-		c.returnPort = argv[0]->i;
-		char portString[16];
-		sprintf(portString,"%i",c.returnPort);
-		c.returnAddress = lo_address_new( lo_address_get_hostname(lo_message_get_source(data)), portString);
-		m_clients[url] = c; // 5 strikes and your out!
+	}
+	__sync_fetch_and_sub(&manager->m_dispatching, 1);
+	return 0;
+}
 
-		// send back an ack
-		lo_send(c.returnAddress, "/ack", "s", "OSC returning ack");
+int Resound::OSCManager::lo_cb_handles(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data){
+	OSCManager* manager = static_cast<OSCManager*>(user_data);
+	// the reply holds address and handle pairs in the order asked, -1 for an unknown address
+	lo_message reply = lo_message_new();
+	for(int n = 0; n < argc; ++n){
+		if(types[n] != 's') continue;
+		lo_message_add_string(reply, &argv[n]->s);
+		lo_message_add_int32(reply, manager->get_handle(&argv[n]->s));
+	}
+	lo_send_message(lo_message_get_source(data), "/resound/params/handles", reply);
+	lo_message_free(reply);
+	return 0;
+}
+
+void Resound::OSCManager::recv_syn(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data){
+	if(argc > 0 && types[0] == 'i'){
+		lo_address source = lo_message_get_source(data);
+		char* sourceUrl = lo_address_get_url(source);
+		std::string url(sourceUrl);
+		std::free(sourceUrl);
+		int port = argv[0]->i;
+
+		pthread_mutex_lock(&m_clientLock);
+		ActiveClient& c = m_clients[url];
+		c.timeToLive = TIME_TO_LIVE; // 5 strikes and your out!
+		lo_address ack = c.returnAddress;
+		if(!c.returnAddress || c.returnPort != port){
+			// a ping from a known client only refreshes it, the address is made once and readers need no new snapshot
+			std::vector<lo_address> dropped;
+			if(c.returnAddress){
+				dropped.push_back(c.returnAddress);
+			} else {
+				// this is a new client tel the world
+				std::cout << "OSC new client detected at " << url << " on port " << port << "\n";
+			}
+			c.url = url;
+			c.returnPort = port;
+			char portString[16];
+			sprintf(portString,"%i",c.returnPort);
+			c.returnAddress = lo_address_new(lo_address_get_hostname(source), portString);
+			ack = c.returnAddress;
+			publish_clients(dropped);
+		}
+		// send back an ack, under the lock so expiry cannot free the address meanwhile
+		lo_send(ack, "/ack", "s", "OSC returning ack");
+		pthread_mutex_unlock(&m_clientLock);
 	}
 }
 
@@ -100,16 +209,18 @@ void Resound::OSCManager::recv_ack(const char *path, const char *types, lo_arg *
 }
 
 void Resound::OSCManager::update_clients(){
+	pthread_mutex_lock(&m_clientLock);
+	std::vector<lo_address> dropped;
+	std::vector<std::string> expired;
 	ActiveClientMap::iterator it;
 	for(it=m_clients.begin(); it != m_clients.end(); /*no increment because of removal see later*/){
 		ActiveClient& c = it->second;
 		--c.timeToLive;
 		if(c.timeToLive <= 0){
 			std::cout << "OSC client " << c.url << " has disconnected. Removing from active client list.\n";
-			if(c.returnAddress) {
-				lo_address_free(c.returnAddress);
-				c.returnAddress = 0;
-			}
+			// a reader may still be sending to it, it is freed with the snapshot it was last in
+			if(c.returnAddress) dropped.push_back(c.returnAddress);
+			expired.push_back(it->first);
 			// remove him cause we havent heard from him for a while
 			ActiveClientMap::iterator prev = it;
 			++it; // increment iterator
@@ -118,27 +229,191 @@ void Resound::OSCManager::update_clients(){
 			++it;
 		}
 	}
-	
+	if(!dropped.empty()){
+		publish_clients(dropped);
+	} else {
+		free_retired();
+	}
+	pthread_mutex_unlock(&m_clientLock);
+	for(unsigned int n = 0; n < expired.size(); ++n){
+		on_client_expired(expired[n]);
+	}
+}
+
+void Resound::OSCManager::poll_expiry(){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if(now.tv_sec - m_lastExpiry.tv_sec < EXPIRY_INTERVAL) return;
+	m_lastExpiry = now;
+	update_clients();
+}
+
+void Resound::OSCManager::publish_clients(std::vector<lo_address>& dropped){
+	ClientSnapshot* next = new ClientSnapshot;
+	for(ActiveClientMap::iterator it = m_clients.begin(); it != m_clients.end(); ++it){
+		next->clients.push_back(it->second);
+	}
+	ClientSnapshot* old = m_snapshot;
+	old->retired.swap(dropped);
+	__sync_synchronize(); // the snapshot before the pointer
+	m_snapshot = next;
+	m_retiredSnapshots.push_back(old);
+	free_retired();
+}
+
+void Resound::OSCManager::free_retired(){
+	// a reader that arrives after this check already sees the newest snapshot, which is never retired
+	__sync_synchronize();
+	if(m_readers != 0) return;
+	for(unsigned int n = 0; n < m_retiredSnapshots.size(); ++n){
+		ClientSnapshot* s = m_retiredSnapshots[n];
+		for(unsigned int a = 0; a < s->retired.size(); ++a){
+			lo_address_free(s->retired[a]);
+		}
+		delete s;
+	}
+	m_retiredSnapshots.clear();
+}
+
+const Resound::ClientSnapshot& Resound::OSCManager::acquire_clients(){
+	__sync_fetch_and_add(&m_readers, 1); // a full barrier, the pointer is read after the count is up
+	return *m_snapshot;
+}
+
+void Resound::OSCManager::release_clients(){
+	__sync_fetch_and_sub(&m_readers, 1);
 }
 
 void Resound::OSCManager::add_method(std::string path, std::string typeSpec, lo_method_handler handler, void* userData){
 	lo_server_thread_add_method(m_loServerThread, path.c_str(), typeSpec.c_str(), handler, userData);
 }
 
+void Resound::OSCManager::add_method(std::string path, lo_method_handler handler, void* userData){
+	lo_server_thread_add_method(m_loServerThread, path.c_str(), NULL, handler, userData);
+}
+
+void Resound::OSCManager::del_method(std::string path, std::string typeSpec){
+	lo_server_thread_del_method(m_loServerThread, path.c_str(), typeSpec.c_str());
+}
+
 void Resound::OSCManager::send_osc_to_all_clients(const char* addr, const char* format, ... )
 {
-	ActiveClientMap::iterator it;
-	for(it=m_clients.begin(); it != m_clients.end(); ++it){
+	const ClientSnapshot& snapshot = acquire_clients();
+	if(!snapshot.clients.empty()){
+		// one message for every client
 		va_list argptr;
 		va_start(argptr, format);
-		ActiveClient& c = it->second;
 		lo_message msg = lo_message_new();
 		lo_message_add_varargs(msg, format, argptr);
-    	lo_send_message(c.returnAddress, addr, msg);
-		lo_message_free(msg);
 		va_end(argptr);
+		for(unsigned int n = 0; n < snapshot.clients.size(); ++n){
+			lo_send_message(snapshot.clients[n].returnAddress, addr, msg);
+		}
+		lo_message_free(msg);
+	}
+	release_clients();
+}
+
+void Resound::OSCManager::add_target(const std::string& path, lo_method_handler handler, void* userData){
+	OSCTarget t = { handler, userData };
+	pthread_mutex_lock(&m_targetLock);
+	m_targets[path].push_back(t);
+	pthread_mutex_unlock(&m_targetLock);
+}
+
+void Resound::OSCManager::remove_target(const std::string& path, void* userData){
+	pthread_mutex_lock(&m_targetLock);
+	OSCAddressTable::TargetMap::iterator it = m_targets.find(path);
+	if(it != m_targets.end()){
+		std::vector<OSCTarget>& targets = it->second;
+		for(unsigned int n = 0; n < targets.size();){
+			if(targets[n].userData == userData){
+				targets.erase(targets.begin() + n);
+			} else {
+				++n;
+			}
+		}
+		if(targets.empty()) m_targets.erase(it);
+	}
+	pthread_mutex_unlock(&m_targetLock);
+}
+
+void Resound::OSCManager::publish_targets(){
+	pthread_mutex_lock(&m_targetLock);
+	for(OSCAddressTable::TargetMap::iterator it = m_targets.begin(); it != m_targets.end(); ++it){
+		if(!m_handles.count(it->first)){
+			int handle = m_handles.size();
+			m_handles[it->first] = handle;
+		}
 	}
-    
+	OSCAddressTable* next = new OSCAddressTable(m_targets, m_handles);
+	OSCAddressTable* old = m_table;
+	__sync_synchronize(); // the table before the pointer
+	m_table = next;
+	m_retiredTables.push_back(old);
+	// as with the client snapshots, a dispatch starting after this check already has the new table
+	__sync_synchronize();
+	if(m_dispatching == 0){
+		for(unsigned int n = 0; n < m_retiredTables.size(); ++n) delete m_retiredTables[n];
+		m_retiredTables.clear();
+	}
+	pthread_mutex_unlock(&m_targetLock);
 }
 
+int Resound::OSCManager::get_handle(const std::string& path){
+	pthread_mutex_lock(&m_targetLock);
+	OSCAddressTable::HandleMap::iterator it = m_handles.find(path);
+	int handle = it == m_handles.end() ? -1 : it->second;
+	pthread_mutex_unlock(&m_targetLock);
+	return handle;
+}
 
+// -------------------------------------------- OSCAddressTable
+
+Resound::OSCAddressTable::OSCAddressTable(const TargetMap& targets, const HandleMap& handles){
+	uint32_t size = 16;
+	while(size < targets.size() * 2) size *= 2;
+	mask_ = size - 1;
+	slots_.assign(size, -1);
+	entries_.reserve(targets.size());
+	for(TargetMap::const_iterator it = targets.begin(); it != targets.end(); ++it){
+		Entry e;
+		e.path = it->first;
+		e.hash = hash(e.path.c_str());
+		e.targets = it->second;
+		uint32_t slot = e.hash & mask_;
+		while(slots_[slot] >= 0) slot = (slot + 1) & mask_;
+		slots_[slot] = entries_.size();
+		entries_.push_back(e);
+	}
+	handleEntries_.assign(handles.size(), -1);
+	for(unsigned int n = 0; n < entries_.size(); ++n){
+		HandleMap::const_iterator it = handles.find(entries_[n].path);
+		if(it != handles.end()) handleEntries_[it->second] = n;
+	}
+}
+
+const std::vector<Resound::OSCTarget>* Resound::OSCAddressTable::find(int handle, const char*& path) const {
+	if(handle < 0 || handle >= (int)handleEntries_.size() || handleEntries_[handle] < 0) return 0;
+	const Entry& e = entries_[handleEntries_[handle]];
+	path = e.path.c_str();
+	return &e.targets;
+}
+
+const std::vector<Resound::OSCTarget>* Resound::OSCAddressTable::find(const char* path) const {
+	uint32_t h = hash(path);
+	for(uint32_t slot = h & mask_; slots_[slot] >= 0; slot = (slot + 1) & mask_){
+		const Entry& e = entries_[slots_[slot]];
+		if(e.hash == h && e.path == path) return &e.targets;
+	}
+	return 0;
+}
+
+uint32_t Resound::OSCAddressTable::hash(const char* path){
+	uint32_t h = 2166136261u;
+	for(const unsigned char* p = (const unsigned char*)path; *p; ++p){
+		h ^= *p;
+		h *= 16777619u;
+	}
+	return h;
+}
@@ -0,0 +1,330 @@
+//    Resound
+//    Copyright 2009 David Moore and James Mooney
+//
+//    This file is part of Resound.
+//
+//    Resound is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    Resound is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Resound; if not, write to the Free Software
+//    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include "resoundnv/parallel.hpp"
+#include "resoundnv/core.hpp"
+#include <algorithm>
+#include <cerrno>
+
+// -------------------------------------------- DspWorkerPool
+
+DspWorkerPool::DspWorkerPool(JackEngine* jack, int threadCount) :
+		continue_(true),
+		func_(0),
+		arg_(0),
+		itemCount_(0),
+		nextItem_(0)
+{
+	assert(jack);
+	sem_init(&start_, 0, 0);
+	sem_init(&done_, 0, 0);
+	for(int n = 1; n < threadCount; ++n){
+		pthread_t thread;
+		if(jack->create_thread(&thread, DspWorkerPool::worker_thread, this) == 0){
+			threads_.push_back(thread);
+		} else {
+			std::cout << "DspWorkerPool could not create worker thread " << n << std::endl;
+		}
+	}
+	std::cout << "DspWorkerPool running with " << get_thread_count() << " threads" << std::endl;
+}
+
+DspWorkerPool::~DspWorkerPool(){
+	continue_ = false;
+	__sync_synchronize();
+	for(unsigned int n = 0; n < threads_.size(); ++n){
+		sem_post(&start_);
+	}
+	for(unsigned int n = 0; n < threads_.size(); ++n){
+		pthread_join(threads_[n], 0);
+	}
+	sem_destroy(&start_);
+	sem_destroy(&done_);
+}
+
+void DspWorkerPool::run(DspJobFunc func, void* arg, int count){
+	func_ = func;
+	arg_ = arg;
+	itemCount_ = count;
+	nextItem_ = 0;
+	__sync_synchronize();
+	// only wake as many workers as there is work for
+	int workers = std::min((int)threads_.size(), count - 1);
+	for(int n = 0; n < workers; ++n){
+		sem_post(&start_);
+	}
+	run_items();
+	for(int n = 0; n < workers; ++n){
+		while(sem_wait(&done_) != 0 && errno == EINTR){}
+	}
+}
+
+void DspWorkerPool::run_items(){
+	int item;
+	while((item = __sync_fetch_and_add(&nextItem_, 1)) < itemCount_){
+		func_(arg_, item);
+	}
+}
+
+void DspWorkerPool::worker_loop(){
+	while(true){
+		while(sem_wait(&start_) != 0 && errno == EINTR){}
+		if(!continue_) break;
+		run_items();
+		sem_post(&done_);
+	}
+}
+
+void* DspWorkerPool::worker_thread(void* arg){
+	DspWorkerPool* pool = (DspWorkerPool*) arg;
+	pool->worker_loop();
+	return 0;
+}
+
+// -------------------------------------------- DspSchedule
+
+DspSchedule::DspSchedule(const BehaviourVector& behaviours, const std::set<Behaviour*>& mixed, const LoudspeakerVector& loudspeakers, int lanes, DspStats& stats) :
+		loudspeakers_(loudspeakers),
+		offset_(0),
+		nframes_(0),
+		currentLevel_(0)
+{
+	assert(lanes > 0);
+
+	// share the buses round robin between the lanes
+	BusLaneMap busLanes;
+	std::vector<AudioBufferSet> laneBuses(lanes);
+	laneLoudspeakers_.resize(lanes);
+	laneLoudspeakerTimers_.resize(lanes);
+	for(unsigned int n = 0; n < loudspeakers_.size(); ++n){
+		int lane = n % lanes;
+		AudioBuffer* bus = loudspeakers_[n]->get_buffer();
+		busLanes[bus] = lane;
+		laneBuses[lane].insert(bus);
+		laneLoudspeakers_[lane].push_back(loudspeakers_[n]);
+		loudspeakerTimers_.push_back(stats.get_timer(loudspeakers_[n]));
+		laneLoudspeakerTimers_[lane].push_back(loudspeakerTimers_.back());
+	}
+
+	// split the behaviours into tasks, keeping the serial order
+	TaskVector tasks;
+	for(unsigned int n = 0; n < behaviours.size(); ++n){
+		Behaviour* b = behaviours[n];
+		DspTimer* timer = stats.get_timer(b);
+		if(mixed.count(b)){
+			laneBehaviours_.push_back(b);
+			laneBehaviourTimers_.push_back(timer);
+			continue;
+		}
+		AudioBufferSet reads, writes;
+		b->get_buffer_usage(reads, writes);
+		if(b->supports_bus_lanes()){
+			b->assign_bus_lanes(busLanes);
+			laneBehaviours_.push_back(b);
+			laneBehaviourTimers_.push_back(timer);
+			for(int lane = 0; lane < lanes; ++lane){
+				Task t;
+				t.behaviours.push_back(b);
+				t.timers.push_back(timer);
+				t.lane = lane;
+				t.reads = reads;
+				for(AudioBufferSet::iterator it = writes.begin(); it != writes.end(); ++it){
+					// buses owned by other lanes are left alone, anything else is kept
+					BusLaneMap::iterator bl = busLanes.find(*it);
+					if(bl == busLanes.end() || bl->second == lane) t.writes.insert(*it);
+				}
+				if(!t.writes.empty()) tasks.push_back(t);
+			}
+		} else {
+			Task t;
+			t.behaviours.push_back(b);
+			t.timers.push_back(timer);
+			t.reads = reads;
+			t.writes = writes;
+			tasks.push_back(t);
+		}
+	}
+
+	// a task must run after every earlier task it conflicts with
+	std::vector<int> taskLevel(tasks.size(), 0);
+	LevelVector levels;
+	for(unsigned int n = 0; n < tasks.size(); ++n){
+		int level = 0;
+		for(unsigned int m = 0; m < n; ++m){
+			if(taskLevel[m] >= level && conflicts(tasks[m], tasks[n])){
+				level = taskLevel[m] + 1;
+			}
+		}
+		taskLevel[n] = level;
+		if((int)levels.size() <= level) levels.resize(level + 1);
+		levels[level].push_back(tasks[n]);
+	}
+
+	// consecutive levels of lane tasks that only depend on their own lane become one chain per lane
+	for(unsigned int n = 0; n < levels.size(); ++n){
+		if(!levels_.empty() && can_merge(levels_.back(), levels[n])){
+			merge_lanes(levels_.back(), levels[n]);
+		} else {
+			levels_.push_back(levels[n]);
+		}
+	}
+}
+
+bool DspSchedule::conflicts(const Task& a, const Task& b){
+	// write after write, read after write and write after read all force an order
+	for(AudioBufferSet::const_iterator it = a.writes.begin(); it != a.writes.end(); ++it){
+		if(b.writes.count(*it) || b.reads.count(*it)) return true;
+	}
+	for(AudioBufferSet::const_iterator it = a.reads.begin(); it != a.reads.end(); ++it){
+		if(b.writes.count(*it)) return true;
+	}
+	return false;
+}
+
+bool DspSchedule::can_merge(const TaskVector& a, const TaskVector& b){
+	for(unsigned int n = 0; n < a.size(); ++n){
+		if(a[n].lane == ALL_LANES) return false;
+	}
+	for(unsigned int n = 0; n < b.size(); ++n){
+		if(b[n].lane == ALL_LANES) return false;
+	}
+	for(unsigned int n = 0; n < a.size(); ++n){
+		for(unsigned int m = 0; m < b.size(); ++m){
+			if(a[n].lane != b[m].lane && conflicts(a[n], b[m])) return false;
+		}
+	}
+	return true;
+}
+
+void DspSchedule::merge_lanes(TaskVector& into, const TaskVector& from){
+	// tasks of one lane within a level never conflict so they can be chained in any order,
+	// chaining the later level after them keeps every dependency satisfied
+	TaskVector merged;
+	for(int pass = 0; pass < 2; ++pass){
+		const TaskVector& src = pass == 0 ? into : from;
+		for(unsigned int n = 0; n < src.size(); ++n){
+			const Task& t = src[n];
+			unsigned int m = 0;
+			while(m < merged.size() && merged[m].lane != t.lane) ++m;
+			if(m == merged.size()){
+				merged.push_back(t);
+			} else {
+				Task& chain = merged[m];
+				chain.behaviours.insert(chain.behaviours.end(), t.behaviours.begin(), t.behaviours.end());
+				chain.timers.insert(chain.timers.end(), t.timers.begin(), t.timers.end());
+				chain.reads.insert(t.reads.begin(), t.reads.end());
+				chain.writes.insert(t.writes.begin(), t.writes.end());
+			}
+		}
+	}
+	into.swap(merged);
+}
+
+void DspSchedule::pre_process(jack_nframes_t nframes){
+	// loudspeakers must be preprocessed to clear buffers
+	DSP_TIMER_START(t);
+	for(unsigned int n = 0; n < loudspeakers_.size(); ++n){
+		loudspeakers_[n]->pre_process(nframes);
+		DSP_TIMER_LAP(t, loudspeakerTimers_[n]);
+	}
+}
+
+void DspSchedule::process(DspWorkerPool& pool, jack_nframes_t offset, jack_nframes_t nframes){
+	offset_ = offset;
+	nframes_ = nframes;
+
+	// control rate work happens once, before any lane sums
+	DSP_TIMER_START(t);
+	for(unsigned int n = 0; n < laneBehaviours_.size(); ++n){
+		if(!laneBehaviours_[n]->is_bypassed()) laneBehaviours_[n]->process_control(offset, nframes);
+		DSP_TIMER_LAP(t, laneBehaviourTimers_[n]);
+	}
+	for(unsigned int n = 0; n < levels_.size(); ++n){
+		currentLevel_ = &levels_[n];
+		if(levels_[n].size() == 1){
+			run_task(this, 0);
+		} else {
+			pool.run(DspSchedule::run_task, this, levels_[n].size());
+		}
+	}
+}
+
+void DspSchedule::post_process(DspWorkerPool& pool, jack_nframes_t nframes){
+	nframes_ = nframes;
+	// loudspeakers can now be processed out, each lane owns its own
+	pool.run(DspSchedule::run_post_process, this, laneLoudspeakers_.size());
+}
+
+void DspSchedule::run_task(void* arg, int item){
+	DspSchedule* schedule = (DspSchedule*) arg;
+	Task& t = (*schedule->currentLevel_)[item];
+	jack_nframes_t offset = schedule->offset_;
+	jack_nframes_t nframes = schedule->nframes_;
+	// a lane behaviour is charged by every lane running it at once
+	DSP_TIMER_START(start);
+	if(t.lane == ALL_LANES){
+		for(unsigned int n = 0; n < t.behaviours.size(); ++n){
+			if(!t.behaviours[n]->is_bypassed()) t.behaviours[n]->process(offset, nframes);
+			DSP_TIMER_LAP_SHARED(start, t.timers[n]);
+		}
+	} else {
+		for(unsigned int n = 0; n < t.behaviours.size(); ++n){
+			if(!t.behaviours[n]->is_bypassed()) t.behaviours[n]->process_lane(offset, nframes, t.lane);
+			DSP_TIMER_LAP_SHARED(start, t.timers[n]);
+		}
+	}
+}
+
+void DspSchedule::run_post_process(void* arg, int item){
+	DspSchedule* schedule = (DspSchedule*) arg;
+	LoudspeakerVector& loudspeakers = schedule->laneLoudspeakers_[item];
+	std::vector<DspTimer*>& timers = schedule->laneLoudspeakerTimers_[item];
+	DSP_TIMER_START(t);
+	for(unsigned int n = 0; n < loudspeakers.size(); ++n){
+		loudspeakers[n]->post_process(schedule->nframes_);
+		DSP_TIMER_LAP(t, timers[n]);
+	}
+}
+
+int DspSchedule::get_level(Behaviour* b) const{
+	for(unsigned int n = 0; n < levels_.size(); ++n){
+		for(unsigned int t = 0; t < levels_[n].size(); ++t){
+			const BehaviourVector& behaviours = levels_[n][t].behaviours;
+			if(std::find(behaviours.begin(), behaviours.end(), b) != behaviours.end()) return n;
+		}
+	}
+	return -1;
+}
+
+void DspSchedule::print(){
+	std::cout << "DspSchedule " << levels_.size() << " levels over " << laneLoudspeakers_.size() << " lanes" << std::endl;
+	for(unsigned int n = 0; n < levels_.size(); ++n){
+		std::cout << "  level " << n << " :";
+		for(unsigned int t = 0; t < levels_[n].size(); ++t){
+			Task& task = levels_[n][t];
+			std::cout << " [";
+			if(task.lane != ALL_LANES) std::cout << "lane " << task.lane << ":";
+			for(unsigned int b = 0; b < task.behaviours.size(); ++b){
+				std::cout << " " << task.behaviours[b]->get_id();
+			}
+			std::cout << " ]";
+		}
+		std::cout << std::endl;
+	}
+}
@@ -0,0 +1,167 @@
+//    Resound
+//    Copyright 2009 David Moore and James Mooney
+//
+//    This file is part of Resound.
+//
+//    Resound is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    Resound is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Resound; if not, write to the Free Software
+//    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include "resoundnv/paramqueue.hpp"
+#include "resoundnv/behaviour.hpp"
+
+ParamQueue::ParamQueue(size_t capacity) :
+		writeIndex_(0),
+		readIndex_(0),
+		posted_(0),
+		collapsed_(0),
+		dropped_(0),
+		applied_(0),
+		highWater_(0)
+{
+	// one slot is always kept free to tell full from empty
+	size_t size = 2;
+	while(size < capacity + 1) size <<= 1;
+	slots_.resize(size, 0);
+	mask_ = size - 1;
+}
+
+void ParamQueue::post(BParam* param, float value){
+	++posted_;
+	param->pendingValue_ = value;
+	// the value must be visible before we look at the queued flag, see drain
+	__sync_synchronize();
+	if(param->queued_){
+		// still waiting from an earlier post, it will pick up the new value
+		++collapsed_;
+		return;
+	}
+	size_t w = writeIndex_;
+	size_t next = (w + 1) & mask_;
+	if(next == readIndex_){
+		++dropped_;
+		return;
+	}
+	param->queued_ = 1;
+	slots_[w] = param;
+	__sync_synchronize(); // publish the slot before the index
+	writeIndex_ = next;
+
+	size_t depth = get_depth();
+	if(depth > highWater_) highWater_ = depth;
+}
+
+void ParamQueue::drain(){
+	size_t r = readIndex_;
+	size_t w = writeIndex_;
+	__sync_synchronize(); // read the slots after the index
+	while(r != w){
+		BParam* param = slots_[r];
+		// clear the flag before reading the value so a racing post is never lost,
+		// at worst the same value is queued and applied twice
+		param->queued_ = 0;
+		__sync_synchronize();
+		param->apply(param->pendingValue_);
+		++applied_;
+		r = (r + 1) & mask_;
+	}
+	__sync_synchronize();
+	readIndex_ = r;
+}
+
+// -------------------------------------------- TimedParamQueue
+
+TimedParamQueue::TimedParamQueue(size_t capacity) :
+		writeIndex_(0),
+		readIndex_(0),
+		pendingCount_(0),
+		posted_(0),
+		dropped_(0),
+		late_(0),
+		overflowed_(0)
+{
+	size_t size = 2;
+	while(size < capacity + 1) size <<= 1;
+	slots_.resize(size);
+	mask_ = size - 1;
+	pending_.resize(size);
+}
+
+void TimedParamQueue::post(BParam* param, float value, jack_nframes_t frame){
+	++posted_;
+	size_t w = writeIndex_;
+	size_t next = (w + 1) & mask_;
+	if(next == readIndex_){
+		++dropped_;
+		return;
+	}
+	slots_[w] = TimedParamEvent(param, value, frame);
+	__sync_synchronize(); // publish the slot before the index
+	writeIndex_ = next;
+}
+
+void TimedParamQueue::fetch(jack_nframes_t blockStart){
+	size_t r = readIndex_;
+	size_t w = writeIndex_;
+	__sync_synchronize();
+	while(r != w){
+		const TimedParamEvent& e = slots_[r];
+		if(frame_before(e.frame, blockStart)) ++late_;
+		if(pendingCount_ == pending_.size()){
+			// nowhere to keep it, better to apply it early than lose it
+			++overflowed_;
+			e.param->apply(e.value);
+		} else {
+			// insertion sort, events for the same frame keep the order they were sent in
+			size_t n = pendingCount_;
+			while(n > 0 && frame_before(e.frame, pending_[n-1].frame)){
+				pending_[n] = pending_[n-1];
+				--n;
+			}
+			pending_[n] = e;
+			++pendingCount_;
+		}
+		r = (r + 1) & mask_;
+	}
+	__sync_synchronize();
+	readIndex_ = r;
+}
+
+void TimedParamQueue::apply_due(jack_nframes_t frame){
+	size_t due = 0;
+	while(due < pendingCount_ && !frame_before(frame, pending_[due].frame)){
+		pending_[due].param->apply(pending_[due].value);
+		++due;
+	}
+	if(due == 0) return;
+	for(size_t n = due; n < pendingCount_; ++n){
+		pending_[n - due] = pending_[n];
+	}
+	pendingCount_ -= due;
+}
+
+void TimedParamQueue::purge(const std::set<BParam*>& params){
+	size_t kept = 0;
+	for(size_t n = 0; n < pendingCount_; ++n){
+		if(params.count(pending_[n].param)) continue;
+		pending_[kept++] = pending_[n];
+	}
+	pendingCount_ = kept;
+}
+
+jack_nframes_t TimedParamQueue::frames_until_next(jack_nframes_t frame, jack_nframes_t limit) const {
+	if(pendingCount_ == 0) return limit;
+	int d = (int)(pending_[0].frame - frame);
+	if(d <= 0) return 0;
+	return (jack_nframes_t)d < limit ? (jack_nframes_t)d : limit;
+}
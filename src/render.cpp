@@ -0,0 +1,162 @@
+//    Resound
+//    Copyright 2009 David Moore and James Mooney
+//
+//    This file is part of Resound.
+//
+//    Resound is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    Resound is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Resound; if not, write to the Free Software
+//    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include "resoundnv/render.hpp"
+#include "resoundnv/core.hpp"
+#include <time.h>
+#include <cstring>
+#include <algorithm>
+
+OfflineRenderer::OfflineRenderer(ResoundSession& session) :
+		session_(session)
+{
+	assert(session_.is_offline());
+}
+
+OfflineRenderer::~OfflineRenderer(){
+	for(unsigned int n = 0; n < inputs_.size(); ++n){
+		sf_close(inputs_[n].file);
+	}
+	for(unsigned int n = 0; n < outputs_.size(); ++n){
+		sf_close(outputs_[n]);
+	}
+}
+
+void OfflineRenderer::add_input(const std::string& spec){
+	size_t pos = spec.find('=');
+	if(pos == std::string::npos){
+		throw Exception("Render inputs are given as livestream=file");
+	}
+	ObjectId id = spec.substr(0, pos);
+	std::string path = spec.substr(pos + 1);
+
+	Input input;
+	input.port = session_.get_port(id);
+	if(!input.port || !(input.port->get_flags() & JackPortIsInput)){
+		throw Exception("Render input does not name a livestream");
+	}
+	SF_INFO info;
+	memset(&info, 0, sizeof(info));
+	input.file = sf_open(path.c_str(), SFM_READ, &info);
+	if(!input.file){
+		throw Exception("Render input cannot load file, does it exist?");
+	}
+	if(info.channels > 1){
+		sf_close(input.file);
+		throw Exception("Render inputs must be mono files.");
+	}
+	if(info.samplerate != (int)session_.get_sample_rate()){
+		std::cout << "Render input " << path << " is at " << info.samplerate << "Hz, it will not be resampled" << std::endl;
+	}
+	inputs_.push_back(input);
+	std::cout << "Livestream " << id << " fed from " << path << std::endl;
+}
+
+void OfflineRenderer::open_outputs(const std::string& path, bool split){
+	const std::vector<Loudspeaker*>& loudspeakers = session_.get_loudspeakers();
+	if(loudspeakers.empty()){
+		throw Exception("Nothing to render, the session has no loudspeakers.");
+	}
+	SF_INFO info;
+	memset(&info, 0, sizeof(info));
+	info.samplerate = session_.get_sample_rate();
+	info.format = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+	if(split){
+		// file.wav becomes file.<loudspeaker>.wav
+		size_t dot = path.rfind('.');
+		std::string stem = dot == std::string::npos ? path : path.substr(0, dot);
+		std::string extension = dot == std::string::npos ? ".wav" : path.substr(dot);
+		info.channels = 1;
+		for(unsigned int n = 0; n < loudspeakers.size(); ++n){
+			std::string name = stem + "." + loudspeakers[n]->get_id() + extension;
+			SNDFILE* file = sf_open(name.c_str(), SFM_WRITE, &info);
+			if(!file) throw Exception("Cannot open render output file.");
+			outputs_.push_back(file);
+		}
+	} else {
+		info.channels = loudspeakers.size();
+		SNDFILE* file = sf_open(path.c_str(), SFM_WRITE, &info);
+		if(!file) throw Exception("Cannot open render output file.");
+		outputs_.push_back(file);
+		interleaved_.resize(session_.get_buffer_size() * loudspeakers.size());
+	}
+}
+
+void OfflineRenderer::read_inputs(jack_nframes_t nframes){
+	for(unsigned int n = 0; n < inputs_.size(); ++n){
+		float* buffer = inputs_[n].port->get_audio_buffer(nframes);
+		sf_count_t frames = sf_readf_float(inputs_[n].file, buffer, nframes);
+		// silence once the file runs out
+		for(sf_count_t f = frames; f < (sf_count_t)nframes; ++f){
+			buffer[f] = 0.0f;
+		}
+	}
+}
+
+void OfflineRenderer::write_outputs(jack_nframes_t nframes){
+	const std::vector<Loudspeaker*>& loudspeakers = session_.get_loudspeakers();
+	if(outputs_.size() == 1 && loudspeakers.size() > 1){
+		unsigned int channels = loudspeakers.size();
+		for(unsigned int c = 0; c < channels; ++c){
+			const float* buffer = loudspeakers[c]->get_port()->get_audio_buffer(nframes);
+			for(jack_nframes_t f = 0; f < nframes; ++f){
+				interleaved_[f * channels + c] = buffer[f];
+			}
+		}
+		sf_writef_float(outputs_[0], &interleaved_[0], nframes);
+	} else {
+		for(unsigned int n = 0; n < outputs_.size(); ++n){
+			sf_writef_float(outputs_[n], loudspeakers[n]->get_port()->get_audio_buffer(nframes), nframes);
+		}
+	}
+}
+
+void OfflineRenderer::run(const std::string& path, bool split, float seconds){
+	size_t length = (size_t)(seconds * session_.get_sample_rate());
+	if(length == 0){
+		const std::vector<Diskstream*>& diskstreams = session_.get_diskstreams();
+		for(unsigned int n = 0; n < diskstreams.size(); ++n){
+			length = std::max(length, diskstreams[n]->get_length());
+		}
+		if(length == 0){
+			throw Exception("Render length must be given when there are no diskstreams.");
+		}
+	}
+	open_outputs(path, split);
+
+	jack_nframes_t nframes = session_.get_buffer_size();
+	size_t blocks = (length + nframes - 1) / nframes;
+	std::cout << "Rendering " << blocks << " blocks of " << nframes << " frames to " << path << std::endl;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(size_t b = 0; b < blocks; ++b){
+		session_.fill_diskstreams(nframes);
+		read_inputs(nframes);
+		session_.process_offline();
+		// the last block is cut short so the file is exactly the length asked for
+		jack_nframes_t frames = std::min((size_t)nframes, length - b * nframes);
+		write_outputs(frames);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double wall = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+	double audio = (double)length / session_.get_sample_rate();
+	printf("Rendered %.2fs of audio in %.3fs, %.1fx realtime\n", audio, wall, wall > 0.0 ? audio / wall : 0.0);
+}
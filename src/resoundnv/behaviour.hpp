@@ -18,49 +18,116 @@
 //    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #pragma once
 #include "resound_types.hpp"
+#include "paramqueue.hpp"
 
 class AudioStream;
 class Loudspeaker;
 
+/// a set of buffers, used to describe what a behaviour touches during process
+typedef std::set<AudioBuffer*> AudioBufferSet;
+/// maps each loudspeaker bus buffer to the dsp lane (thread slot) that owns it
+typedef std::map<AudioBuffer*,int> BusLaneMap;
+/// lane value meaning every bus regardless of lane assignment
+const int ALL_LANES = -1;
+
+/// a direct call to a dsp function, the compiled dsp program is a flat list of these
+typedef void (*DspProcessFunc)(void* object, jack_nframes_t offset, jack_nframes_t nframes);
+class Behaviour;
+/// calls T::process without going through the vtable
+template<class T> void dsp_process_thunk(void* object, jack_nframes_t offset, jack_nframes_t nframes){
+	static_cast<T*>(static_cast<Behaviour*>(object))->T::process(offset, nframes);
+}
+/// calls T::process_control without going through the vtable
+template<class T> void dsp_control_thunk(void* object, jack_nframes_t offset, jack_nframes_t nframes){
+	static_cast<T*>(static_cast<Behaviour*>(object))->T::process_control(offset, nframes);
+}
+
 // an actual dsp route, created by parsing the routing cass/cls "language"
 class BRoute{
 	AudioBuffer* fromBuffer_;
 	AudioBuffer* toBuffer_;
 	float gain_;
-	void* userData_; ///< allow the behaviour to store some aribitrary info
+	// the state the dsp keeps per route, typed rather than behind a pointer so the routes of a
+	// behaviour are walked as one array
+	SmoothedValue level_; ///< the gain the route is summed at, set by the behaviour at control rate and ramped to
+	int lane_; ///< the dsp lane that owns the destination bus
 public:
-	BRoute() : fromBuffer_(0), toBuffer_(0), gain_(1.0f), userData_(0) {}
+	BRoute() : fromBuffer_(0), toBuffer_(0), gain_(1.0f), level_(0.0f), lane_(0) {}
 	BRoute(AudioBuffer* fromBuffer, AudioBuffer* toBuffer, float gain) :
-			fromBuffer_(fromBuffer), toBuffer_(toBuffer) , gain_(gain), userData_(0)
+			fromBuffer_(fromBuffer), toBuffer_(toBuffer) , gain_(gain), level_(0.0f), lane_(0)
 			{}
 	AudioBuffer* get_from() const {return fromBuffer_;}
 	AudioBuffer* get_to() const {return toBuffer_;}
 	float get_gain() const {return gain_; }
-	void* get_user_data() const { return userData_; }
-	void set_user_data(void* userData) { userData_=userData; }
+	/// the level being ramped to, with any gain its source buffer leaves to its readers folded in
+	float get_level() const {return level_.get_target() * fromBuffer_->get_read_gain(); }
+	void set_level(float level) { level_.set_target(level); }
+	void set_ramp_time(float ms, float sampleRate) { level_.set_ramp_time(ms, sampleRate); }
+	/// move the level on by a (sub) block, see SmoothedValue::advance. the source read gain is folded in.
+	/// called once per (sub) block by whoever sums the route
+	size_t advance_level(size_t nframes, float& start, float& step){
+		size_t frames = level_.advance(nframes, start, step);
+		float readGain = fromBuffer_->get_read_gain();
+		start *= readGain;
+		step *= readGain;
+		return frames;
+	}
+	int get_lane() const {return lane_; }
+	void set_lane(int lane) { lane_ = lane; }
+	/// true if this route should be summed when processing the given lane
+	bool in_lane(int lane) const { return lane == ALL_LANES || lane == lane_; }
 };
 
 typedef std::vector<BRoute> BRouteArray; // sequential array of routes
 
-// routes are stored in behaviours
+/// a run of routes in a BRouteArray
+class BRouteRange {
+	BRoute* routes_;
+	size_t size_;
+public:
+	BRouteRange(BRoute* routes, size_t size) : routes_(routes), size_(size) {}
+	size_t size() const { return size_; }
+	BRoute& operator[](size_t n) { return routes_[n]; }
+};
+
+// routes are stored in behaviours, every set of a behaviour in one array
 class BRouteSet{
 
 private:
-	BRouteArray routes_;
+	BRouteArray& routes_; ///< the routes of the whole behaviour
+	size_t first_; ///< where this set starts in routes_
+	size_t size_;
 public:
-	BRouteSet(const xmlpp::Node* node);
-	BRouteArray& get_routes() {return routes_; }
+	/// parse the routes, appending them to the routes of the behaviour
+	BRouteSet(const xmlpp::Node* node, BRouteArray& routes);
+	/// the routes of this set, only valid once every set of the behaviour is parsed
+	BRouteRange get_routes() { return BRouteRange(size_ ? &routes_[first_] : 0, size_); }
         /// creates a route from 2 buffer ref structures
         void create_route(const BufferRef& a, const BufferRef& b, float gain);
 };
 
 // parameters for behaviours
 class BParam{
-	float& value_; /// acts directly of variables
+	friend class ParamQueue;
+	friend class TimedParamQueue;
+	float& value_; /// acts directly of variables, only the dsp thread writes it once running
+	volatile float pendingValue_; ///< latest value from osc waiting for the next block
+	volatile int queued_; ///< non zero while waiting in the ParamQueue
 	std::string addr_;
+	SmoothedValue* smoother_; ///< ramps to each new value, null if the value steps
+	float rampTime_; ///< ramp time in ms from the xml, negative for the session default
+	/// set the value on the dsp thread, a smoothed parameter starts ramping to it
+	void apply(float v){
+		value_ = v;
+		if(smoother_) smoother_->set_target(v);
+	}
 public:
-	BParam(float& v, float startingValue);
+	/// a parameter registered with a smoother ramps to every new value over the ramp time
+	/// given by its ramp attribute in ms, or the session default. the behaviour reads the smoother.
+	BParam(float& v, float startingValue, SmoothedValue* smoother = 0);
 	void init_from_xml(const xmlpp::Element* nodeElement);
+	/// set the ramp time of the smoother once the session is known
+	void init_ramp(float defaultMs, float sampleRate);
 	float get_value(){ return value_; }
 	ObjectId get_address(){return addr_;}
 	// callback for osc
@@ -76,6 +143,10 @@ public:
 private:
 	BParamMap params_;
         BufferVector buffers_;
+	float bypass_; ///< the "bypass" parameter, non zero takes the behaviour out of the block
+	bool bypassed_; ///< bypass_ as applied at the last block boundary
+	bool metered_; ///< the "meter" attribute, its buffers are metered and sent as feedback
+	std::vector<VUMeter> meters_; ///< one per buffer when metered
 public:
 	Behaviour();
         virtual ~Behaviour();
@@ -83,8 +154,62 @@ public:
 
 	/// abstract virtualised dsp call
 	/// class is expected to copy from input stream buffers to loudspeaker buffers.
-	/// some processing would occur on the way
-	virtual void process(jack_nframes_t nframes) = 0;
+	/// some processing would occur on the way.
+	/// only frames [offset, offset+nframes) of the block are processed, a block is split
+	/// into several calls when parameter changes are scheduled part way through it.
+	virtual void process(jack_nframes_t offset, jack_nframes_t nframes) = 0;
+
+	/// the function the compiled dsp program calls for this behaviour.
+	/// concrete classes return dsp_process_thunk<Class> so the call is resolved once at compile time,
+	/// the default falls back to a virtual call of process.
+	virtual DspProcessFunc get_process_func() { return Behaviour::virtual_process; }
+	static void virtual_process(void* object, jack_nframes_t offset, jack_nframes_t nframes);
+
+	/// report every buffer read from and written to by process.
+	/// the dsp scheduler uses this to find behaviours that may run concurrently.
+	/// the default reports the behaviours own buffers as written.
+	virtual void get_buffer_usage(AudioBufferSet& reads, AudioBufferSet& writes);
+
+	/// behaviours that sum into loudspeaker buses may split their work by bus lane
+	/// so that several threads can sum into disjoint sets of buses without locking.
+	/// such behaviours must implement process as process_control followed by process_lane(ALL_LANES)
+	virtual bool supports_bus_lanes() { return false; }
+	/// the lane of every bus this behaviour writes, called once when scheduling
+	virtual void assign_bus_lanes(const BusLaneMap& lanes) {}
+	/// control rate part of process, called once per (sub) block before any process_lane call
+	virtual void process_control(jack_nframes_t offset, jack_nframes_t nframes) {}
+	/// sum into only those buses owned by lane
+	virtual void process_lane(jack_nframes_t offset, jack_nframes_t nframes, int lane) {}
+
+	/// routeset behaviours whose process_lane only sums each route at its level may have their routes
+	/// summed by a MixMatrix instead, process_control must then set the level of every route
+	virtual bool supports_mix_matrix() { return false; }
+	/// the function the compiled dsp program calls in place of process while a MixMatrix sums the routes
+	virtual DspProcessFunc get_control_func() { return Behaviour::virtual_control; }
+	static void virtual_control(void* object, jack_nframes_t offset, jack_nframes_t nframes);
+
+	/// apply the bypass parameter at a block boundary, true if the behaviour went in or out of bypass.
+	/// a bypassed behaviour is not called at all until it comes out again.
+	bool update_bypass(){
+		bool bypass = bypass_ != 0.0f;
+		if(bypass == bypassed_) return false;
+		bypassed_ = bypass;
+		if(bypass){
+			enter_bypass();
+		} else {
+			// until process says otherwise, not every behaviour tracks silence
+			for(unsigned int n = 0; n < buffers_.size(); ++n) buffers_[n]->set_silent(false);
+		}
+		return true;
+	}
+	bool is_bypassed() const { return bypassed_; }
+	/// silence whatever the behaviour would leave behind once it stops being called,
+	/// the default clears its own buffers
+	virtual void enter_bypass();
+
+	/// true if every buffer this behaviour reads is read through BRoute::get_level,
+	/// so a source that aliases unscaled samples has its gain applied by the route
+	virtual bool applies_read_gain() { return false; }
 
 	/// register a parameter:
 	/// this should be called in a constructor or init function prior to loading base class xml
@@ -92,24 +217,47 @@ public:
 	/// obtain a parameter value
 	// TODO this should really be some sort of fast lookup table pre-built at the start of dsp.
 	float get_parameter_value(const char* name){ return params_[name]->get_value(); }
+	/// every registered parameter by id
+	const BParamMap& get_parameters() const { return params_; }
 
         /// create a buffer and register it with the session
         AudioBuffer* create_buffer(ObjectId subId="", ObjectId forceId="");
         /// get a buffer by index
         AudioBuffer& get_buffer(int n) { return *buffers_[n]; }
+        int get_buffer_count() const { return buffers_.size(); }
+
+	/// true if the behaviour asked for its buffers to be metered, meter="true"
+	bool is_metered() const { return metered_; }
+	/// the meter of buffer n, called while compiling a program
+	VUMeter& get_vu_meter(int n);
 };
 
 /// a stream - a wrapper around an available input buffer
 class Diskstream : public Behaviour {
-	jack_ringbuffer_t* ringBuffer_; ///< a ring buffer is used to ensure non-locking thread safe read
-	static const size_t DISK_STREAM_RING_BUFFER_SIZE = 4096;
-	float* diskBuffer_;
-	float* copyBuffer_;
+	/// a ring buffer per channel streamed is used to ensure non-locking thread safe read,
+	/// the disk thread writes them all together so they always hold the same number of frames
+	std::vector<jack_ringbuffer_t*> ringBuffers_;
+	static const size_t DISK_STREAM_MIN_CHUNK = 256;
+	static const size_t DISK_STREAM_MAX_CHUNK = 16384;
+	size_t ringFrames_; ///< frames read ahead of playback, from --read-ahead
+	size_t chunkFrames_; ///< frames read from disk in one go, a quarter of the read ahead
+	float* diskBuffer_; ///< interleaved frames as read from the file
+	float* channelBuffer_; ///< the same frames one channel after another
+	std::vector<float*> channelPtrs_; ///< where each channel starts in channelBuffer_
 	SNDFILE* file_;
 	SF_INFO info_;
+	int fd_; ///< the file under file_, for page cache hints
+	size_t chunkBytes_; ///< about how much of the file a chunk takes up
+	int firstChannel_; ///< the first channel of the file streamed
+	int channelCount_; ///< channels streamed, one buffer each
 	std::string path_;
 	bool playing_;
         float gain_;
+	volatile size_t lowWater_; ///< fewest frames buffered at the start of a block since play or seek
+	volatile unsigned int underruns_; ///< blocks played as silence because the disk fell behind
+
+	/// read a chunk from disk into the ring buffers
+	void read_chunk();
 public:
 
 	/// construct
@@ -119,12 +267,32 @@ public:
 	/// destruct
 	virtual ~Diskstream();
 
-	/// class is expected to pull as much data as it can from disk into the ring buffer
-	/// this is called from a disk reading thread
-	virtual void disk_process();
+	/// read one chunk from disk into the ring buffers if playing and there is room for it,
+	/// returns the frames read. this is called from a disk reading thread
+	virtual size_t disk_process();
+	/// true if disk_process would read, the disk thread serves the emptiest of these first
+	bool wants_read() { return playing_ && get_free_frames() >= chunkFrames_; }
 
 	/// class is expected to make its next buffer of audio ready. read a block from the ringbuffer
-	virtual void process(jack_nframes_t nframes);
+	virtual void process(jack_nframes_t offset, jack_nframes_t nframes);
+	virtual DspProcessFunc get_process_func() { return dsp_process_thunk<Diskstream>; }
+
+	/// frames read from disk and waiting for process
+	size_t get_buffered_frames() {
+		size_t bytes = jack_ringbuffer_read_space(ringBuffers_[0]);
+		for(unsigned int c = 1; c < ringBuffers_.size(); ++c) bytes = std::min(bytes, jack_ringbuffer_read_space(ringBuffers_[c]));
+		return bytes / sizeof(float);
+	}
+	/// frames that can be read from disk before the read ahead is full
+	size_t get_free_frames();
+	/// frames read ahead of playback when full
+	size_t get_read_ahead() { return ringFrames_; }
+	/// the underrun margin, the fewest frames that were waiting at the start of a block since play or seek
+	size_t get_low_water() { return lowWater_; }
+	/// blocks played as silence because the disk fell behind
+	unsigned int get_underruns() { return underruns_; }
+	/// the length of the sound file in frames
+	size_t get_length() { return info_.frames; }
 
 	/// method to seek the current disk location, lock thread mutex first!
 	void seek(size_t pos);
@@ -147,7 +315,14 @@ public:
 	Livestream();
 	void init_from_xml(const xmlpp::Element* nodeElement);
 	/// class is expected to make its next buffer of audio ready.
-	virtual void process(jack_nframes_t nframes);
+	virtual void process(jack_nframes_t offset, jack_nframes_t nframes);
+	/// at the start of a block, point the buffer at the jack capture buffer instead of copying into it.
+	/// the gain is left to the readers, which must all applies_read_gain. the silent flag is set for the whole block.
+	void alias_port(jack_nframes_t nframes);
+	/// at the start of a block, go back to copying into the buffer with process
+	void unalias_port(){ get_buffer(0).alias(0); }
+	virtual void enter_bypass();
+	virtual DspProcessFunc get_process_func() { return dsp_process_thunk<Livestream>; }
 
         static Behaviour* factory() { return new Livestream(); }
 };
@@ -161,12 +336,27 @@ public:
 	typedef std::vector<BRouteSet*> BRouteSetArray; // sequential array of routes
 private:
 	BRouteSetArray routeSets_;
+	BRouteArray routes_; ///< the routes of every set in one array, routeset by routeset
 public:
 	RouteSetBehaviour();
 	void init_from_xml(const xmlpp::Element* nodeElement);
 
-	virtual void process(jack_nframes_t nframes) = 0;
+	virtual void process(jack_nframes_t offset, jack_nframes_t nframes) = 0;
+	virtual bool applies_read_gain() { return true; }
+	/// drop every route level to zero, a mix matrix ramps the routes out
+	virtual void enter_bypass();
 	BRouteSetArray& get_route_sets() {return routeSets_;}
+	/// every route of every set
+	BRouteRange get_routes() { return BRouteRange(routes_.empty() ? 0 : &routes_[0], routes_.size()); }
+
+	/// routes read their source and write their destination bus
+	virtual void get_buffer_usage(AudioBufferSet& reads, AudioBufferSet& writes);
+	virtual void assign_bus_lanes(const BusLaneMap& lanes);
+protected:
+	/// set the level of every route to its gain times the gain of its routeset
+	static void set_route_levels(BRouteSetArray& routeSets, const std::vector<float>& routeSetGains);
+	/// sum the routes of the lane at their levels, ramping them on
+	static void sum_routes(BRouteRange routes, jack_nframes_t offset, jack_nframes_t nframes, int lane);
 };
 
 /// an IOHelper does not use the routeset interpretation and instead suggests inputs and outputs
@@ -183,6 +373,8 @@ public:
 	void init_from_xml(const xmlpp::Element* nodeElement);
 	BufferArray& get_inputs() {return inputs_;}
 	LoudspeakerArray& get_outputs() {return outputs_;}
+	/// inputs are read, the buses of outputs are written
+	void get_buffer_usage(AudioBufferSet& reads, AudioBufferSet& writes);
 };
 
 /// A dsp pluginable object abstract class generated by factory
@@ -195,7 +387,13 @@ public:
 		register_parameter("level",new BParam(level_,0.0f));
 	}
 
-	virtual void process(jack_nframes_t nframes);
+	virtual void process(jack_nframes_t offset, jack_nframes_t nframes);
+	virtual DspProcessFunc get_process_func() { return dsp_process_thunk<AttBehaviour>; }
+	virtual bool supports_bus_lanes() { return true; }
+	virtual void process_control(jack_nframes_t offset, jack_nframes_t nframes);
+	virtual void process_lane(jack_nframes_t offset, jack_nframes_t nframes, int lane);
+	virtual bool supports_mix_matrix() { return true; }
+	virtual DspProcessFunc get_control_func() { return dsp_control_thunk<AttBehaviour>; }
 	static Behaviour* factory() { return new AttBehaviour(); }
 };
 
@@ -204,13 +402,19 @@ class MultipointCrossfadeBehaviour : public RouteSetBehaviour {
 	float position_, gain_, slope_;
 	LookupTable* hannFunction;
 	static const size_t HANN_TABLE_SIZE=512;
-	float *oldGains_; ///< used for interpolation algorithm
+	std::vector<float> routeSetGains_; ///< per routeset gain calculated at control rate
 public:
 
 	MultipointCrossfadeBehaviour();
 	void init_from_xml(const xmlpp::Element* nodeElement);
 
-	virtual void process(jack_nframes_t nframes);
+	virtual void process(jack_nframes_t offset, jack_nframes_t nframes);
+	virtual DspProcessFunc get_process_func() { return dsp_process_thunk<MultipointCrossfadeBehaviour>; }
+	virtual bool supports_bus_lanes() { return true; }
+	virtual void process_control(jack_nframes_t offset, jack_nframes_t nframes);
+	virtual void process_lane(jack_nframes_t offset, jack_nframes_t nframes, int lane);
+	virtual bool supports_mix_matrix() { return true; }
+	virtual DspProcessFunc get_control_func() { return dsp_control_thunk<MultipointCrossfadeBehaviour>; }
 	static Behaviour* factory() { return new MultipointCrossfadeBehaviour(); }
 };
 
@@ -219,13 +423,19 @@ class ChaseBehaviour : public RouteSetBehaviour {
 	float freq_, phase_, gain_, slope_;
 	LookupTable* hannFunction;
 	static const size_t HANN_TABLE_SIZE=512;
-	float *oldGains_; ///< used for interpolation algorithm
+	std::vector<float> routeSetGains_; ///< per routeset gain calculated at control rate
 	Phasor phasor;
 public:
 
 	ChaseBehaviour();
 	void init_from_xml(const xmlpp::Element* nodeElement);
-	virtual void process(jack_nframes_t nframes);
+	virtual void process(jack_nframes_t offset, jack_nframes_t nframes);
+	virtual DspProcessFunc get_process_func() { return dsp_process_thunk<ChaseBehaviour>; }
+	virtual bool supports_bus_lanes() { return true; }
+	virtual void process_control(jack_nframes_t offset, jack_nframes_t nframes);
+	virtual void process_lane(jack_nframes_t offset, jack_nframes_t nframes, int lane);
+	virtual bool supports_mix_matrix() { return true; }
+	virtual DspProcessFunc get_control_func() { return dsp_control_thunk<ChaseBehaviour>; }
 	static Behaviour* factory() { return new ChaseBehaviour(); }
 };
 
@@ -234,23 +444,35 @@ public:
 class AmpPanBehaviour : public Behaviour {
 	Vec3 pos_;
 	float gain_;
-	float* oldGains_;
+	std::vector<SmoothedValue> gains_; ///< per output gain calculated at control rate and ramped to
+	std::vector<int> lanes_; ///< the dsp lane of each output
 	IOHelper io_;
 public:
 	AmpPanBehaviour();
 	void init_from_xml(const xmlpp::Element* nodeElement);
-	virtual void process(jack_nframes_t nframes);
+	virtual void process(jack_nframes_t offset, jack_nframes_t nframes);
+	virtual DspProcessFunc get_process_func() { return dsp_process_thunk<AmpPanBehaviour>; }
+	virtual void get_buffer_usage(AudioBufferSet& reads, AudioBufferSet& writes);
+	virtual bool supports_bus_lanes() { return true; }
+	virtual void assign_bus_lanes(const BusLaneMap& lanes);
+	virtual void process_control(jack_nframes_t offset, jack_nframes_t nframes);
+	virtual void process_lane(jack_nframes_t offset, jack_nframes_t nframes, int lane);
+	/// the outputs ramp in again when it comes back
+	virtual void enter_bypass();
 	static Behaviour* factory() { return new AmpPanBehaviour(); }
 };
 
 /// A dsp pluginable object abstract class generated by factory
 class GainInsertBehaviour : public Behaviour {
 	float gain_;
+	SmoothedValue gainRamp_;
 	IOHelper io_;
 public:
 	GainInsertBehaviour();
 	void init_from_xml(const xmlpp::Element* nodeElement);
-	virtual void process(jack_nframes_t nframes);
+	virtual void process(jack_nframes_t offset, jack_nframes_t nframes);
+	virtual DspProcessFunc get_process_func() { return dsp_process_thunk<GainInsertBehaviour>; }
+	virtual void get_buffer_usage(AudioBufferSet& reads, AudioBufferSet& writes);
 	static Behaviour* factory() { return new GainInsertBehaviour(); }
 };
 
@@ -265,7 +487,9 @@ class RingmodInsertBehaviour : public Behaviour {
 public:
 	RingmodInsertBehaviour();
 	void init_from_xml(const xmlpp::Element* nodeElement);
-	virtual void process(jack_nframes_t nframes);
+	virtual void process(jack_nframes_t offset, jack_nframes_t nframes);
+	virtual DspProcessFunc get_process_func() { return dsp_process_thunk<RingmodInsertBehaviour>; }
+	virtual void get_buffer_usage(AudioBufferSet& reads, AudioBufferSet& writes);
 	static Behaviour* factory() { return new RingmodInsertBehaviour(); }
 };
 
@@ -274,12 +498,20 @@ class LADSPABehaviour : public Behaviour {
 	std::string plugName_;
 	const LADSPA_Descriptor *descriptor_;
 	LADSPA_Handle instance_;
+	bool active_; ///< activate has been called on instance_
 	IOHelper io_;
 	std::vector<float*> controlPortValues_;
+	typedef std::pair<unsigned long, AudioBuffer*> AudioPortConnection;
+	std::vector<AudioPortConnection> audioPorts_; ///< plugin audio port index and the buffer it uses
+	void connect_audio_ports(jack_nframes_t offset);
 public:
 	LADSPABehaviour();
+	/// safe on an instance whose init_from_xml threw part way
+	virtual ~LADSPABehaviour();
 	void init_from_xml(const xmlpp::Element* nodeElement);
-	virtual void process(jack_nframes_t nframes);
+	virtual void process(jack_nframes_t offset, jack_nframes_t nframes);
+	virtual DspProcessFunc get_process_func() { return dsp_process_thunk<LADSPABehaviour>; }
+	virtual void get_buffer_usage(AudioBufferSet& reads, AudioBufferSet& writes);
 	static Behaviour* factory() { return new LADSPABehaviour(); }
 };
 
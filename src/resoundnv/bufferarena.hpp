@@ -0,0 +1,63 @@
+//    Resound
+//    Copyright 2009 David Moore and James Mooney
+//
+//    This file is part of Resound.
+//
+//    Resound is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    Resound is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Resound; if not, write to the Free Software
+//    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <vector>
+
+/// a session wide pool the audio buffers are cut from.
+/// buffers are taken 64 byte aligned from large slabs in the order they are allocated,
+/// document order, so the buffers a block touches sit together rather than being scattered
+/// over the heap. slabs may be backed by hugepages, they are locked into ram when the limits
+/// allow and prefaulted so the dsp thread never takes a page fault on a buffer.
+/// only used while loading, from one thread.
+class BufferArena {
+	struct Slab {
+		char* base;
+		size_t size;
+		size_t used;
+	};
+	std::vector<Slab> slabs_;
+	/// released buffers by size in bytes, handed out again before a slab is cut further
+	typedef std::map<size_t, std::vector<float*> > FreeMap;
+	FreeMap free_;
+	size_t slabSize_;
+	bool hugePages_;
+	bool locked_; ///< every slab so far was locked
+	size_t buffers_; ///< buffers currently handed out
+public:
+	static const size_t ALIGNMENT = 64;
+	static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+	/// slabs are at least slabSize bytes, hugePages asks for slabs backed by hugepages
+	/// and falls back to normal pages if none are available
+	BufferArena(size_t slabSize, bool hugePages);
+	~BufferArena();
+
+	/// a zeroed buffer of frames floats
+	float* allocate(size_t frames);
+	/// give a buffer back, frames must be what it was allocated with
+	void release(float* buffer, size_t frames);
+
+	/// print the slab usage
+	void print();
+private:
+	void add_slab(size_t bytes);
+};
@@ -21,6 +21,10 @@
 
 #include "resound_types.hpp"
 #include "behaviour.hpp"
+#include "parallel.hpp"
+#include "dspgraph.hpp"
+#include "bufferarena.hpp"
+#include <semaphore.h>
 
 
 
@@ -68,6 +72,7 @@ class Loudspeaker : public DynamicObject{
 	Vec3 pos_;
 	float az_, el_;
 	float gain_;
+	bool direct_; ///< the bus is the jack port buffer for the block, no copy is made
 protected:
 	VUMeter vuMeter_;
 public:
@@ -83,12 +88,58 @@ public:
 	const Vec3& get_position() const {return pos_;}
 	/// return the vumetering object
 	VUMeter& get_vu_meter(){return vuMeter_;}
+	/// the jack port the bus is written to
+	JackPort* get_port(){return port_;}
 };
 
 
 struct CLIOptions{
 	std::string inputXML_;
 	std::string oscPort_;
+	std::string executor_; ///< "serial" or "parallel"
+	int dspThreads_; ///< thread count for the parallel executor, 0 uses every cpu
+	std::string kernel_; ///< buffer kernels to use, see dsp_select_kernels
+	bool hugePages_; ///< back the buffer arena with hugepages
+	bool copyOut_; ///< loudspeakers sum into a private bus and copy it to the port rather than summing into the port
+	bool copyIn_; ///< livestreams always copy their capture port rather than being read in place
+	bool reuseBuffers_; ///< behaviour buffers that are never live at once share storage
+	bool mixMatrix_; ///< routeset behaviours are summed by one mix matrix rather than route by route
+	float meterRate_; ///< meter feedback ticks per second, clients may subscribe to fewer
+	float readAhead_; ///< seconds each diskstream reads ahead of playback
+	int diskThreads_; ///< threads reading diskstreams, a slow read only holds up its own stream
+	float rampTime_; ///< default ms for route levels and smoothed parameters to ramp to a new value
+	int paramQueueSize_; ///< how many distinct parameters may be pending in one block
+	int timedQueueSize_; ///< how many timetagged parameter changes may be waiting for their frame
+	bool offline_; ///< run without a jack server, see JackEngine::init_offline
+	std::string render_; ///< render offline to this file instead of running with jack
+	bool renderSplit_; ///< render one mono file per loudspeaker
+	float renderLength_; ///< seconds to render, 0 renders the longest diskstream
+	int renderSampleRate_;
+	int renderBufferSize_;
+	std::vector<std::string> renderInputs_; ///< livestream=file pairs feeding livestreams when rendering
+
+	/// the defaults of every option, the server shows these in its help and the bench starts from them
+	CLIOptions() :
+		oscPort_("8000"),
+		executor_("serial"),
+		dspThreads_(0),
+		kernel_("auto"),
+		hugePages_(false),
+		copyOut_(false),
+		copyIn_(false),
+		reuseBuffers_(true),
+		mixMatrix_(true),
+		meterRate_(10.0f),
+		readAhead_(1.0f),
+		diskThreads_(2),
+		rampTime_(3.0f),
+		paramQueueSize_(1024),
+		timedQueueSize_(1024),
+		offline_(false),
+		renderSplit_(false),
+		renderLength_(0.0f),
+		renderSampleRate_(48000),
+		renderBufferSize_(256) {}
 };
 
 /// a resound session will read a single xml file and register all jack and disk streams
@@ -101,6 +152,9 @@ private:
 	/// also enables rtti from any of the dynamic objects
 	typedef std::map<ObjectId,DynamicObject*> DynamicObjectMap;
 	DynamicObjectMap dynamicObjects_;
+	/// the same objects in the order they were registered, i.e. document order
+	typedef std::vector<DynamicObject*> DynamicObjectVector;
+	DynamicObjectVector dynamicObjectOrder_;
 
 	/// a set of fast lookup index tables
 
@@ -110,8 +164,82 @@ private:
 	typedef std::vector<Loudspeaker*> LoudspeakerVector;
 	LoudspeakerVector loudspeakers_;
 
-	typedef std::vector<Behaviour*> BehaviourVector;
-	BehaviourVector behaviours_;
+	/// the xml each object was built from, a reload carries over objects whose xml is unchanged
+	typedef std::map<ObjectId,std::string> SignatureMap;
+	SignatureMap signatures_;
+	/// the objects each object looked up while it was being built
+	typedef std::set<ObjectId> ObjectIdSet;
+	typedef std::map<ObjectId,ObjectIdSet> DependencyMap;
+	DependencyMap dependencies_;
+	/// the object currently being built, lookups are recorded as its dependencies
+	ObjectId loadingId_;
+	/// parameters built during a load, their osc addresses go live once the new graph is running
+	std::vector<BParam*> loadedParams_;
+
+	/// jack ports by name. the session owns them so that a rebuilt object can take over
+	/// the port of the object it replaces without the port ever leaving the jack graph.
+	typedef std::map<ObjectId,JackPort*> JackPortMap;
+	JackPortMap ports_;
+	/// ports in use by the session being loaded
+	ObjectIdSet claimedPorts_;
+	/// ports taken over during a load and their connections beforehand, restored if the load fails
+	typedef std::vector<std::pair<JackPort*,JackPortNameList> > PortConnectionsVector;
+	PortConnectionsVector adoptedPorts_;
+
+	/// the compiled dsp graph run by the process callback
+	DspProgram* program_;
+	/// a newly compiled graph waiting for the process callback to pick it up at a block boundary
+	DspProgram* volatile pendingProgram_;
+	/// held by other threads while they look at program_, a reload takes it to delete the old program
+	pthread_mutex_t programLock_;
+	/// parameters of objects being retired, the process callback drops any timed changes to them
+	std::set<BParam*> retiredParams_;
+	volatile bool purgeRetiredParams_;
+	/// counts process callbacks so other threads can wait for the dsp thread to move on
+	volatile unsigned int blockCount_;
+	/// set by osc or SIGHUP, the main thread performs the reload
+	volatile bool reloadRequested_;
+
+	/// what an osc client asked of the meters, clients that never subscribed get every meter every tick
+	struct MeterSubscription {
+		std::set<std::string> names; ///< the meter addresses asked for, empty for every meter
+		unsigned int divisor; ///< sent every divisor feedback ticks, 0 for never
+		unsigned int sends; ///< feedback sent so far, every meter is resent now and then in case a packet was lost
+		unsigned int generation; ///< the program meters and sent were resolved against
+		std::vector<unsigned int> meters; ///< the indices of the meters sent
+		std::vector<MeterReading> sent; ///< by meter index as last sent, unchanged meters are left out
+		MeterSubscription() : divisor(1), sends(0), generation(0) {}
+	};
+	typedef std::map<std::string, MeterSubscription> MeterSubscriptionMap;
+	/// by client url, dropped when the client expires
+	MeterSubscriptionMap meterSubscriptions_;
+	/// the osc thread subscribes while the main thread sends feedback and expires clients
+	pthread_mutex_t meterLock_;
+	/// calls to send_osc_feedback so far
+	unsigned int feedbackTicks_;
+	/// bumped by every program swap, feedback rebuilds its messages and subscriptions when it moves on
+	unsigned int programGeneration_;
+	/// the program the meter messages were built for
+	unsigned int meterGeneration_;
+	/// one message per meter of the running program, built once and handed to every bundle.
+	/// the readings are written into their arguments in place each tick
+	std::vector<lo_message> meterMessages_;
+	/// the address of each meter message
+	std::vector<std::string> meterNames_;
+	/// the readings of this tick, kept to reuse its storage
+	std::vector<MeterReading> meterReadings_;
+
+	/// worker threads for the parallel executor, null when running serially
+	DspWorkerPool* dspPool_;
+
+	/// parameter changes from osc waiting for the next block
+	ParamQueue paramQueue_;
+
+	/// timetagged parameter changes from osc waiting for their frame
+	TimedParamQueue timedParamQueue_;
+
+	/// every audio buffer of the session is cut from here
+	BufferArena bufferArena_;
 
 	/// map of behaviour factories by plugin name
 	typedef std::map<ObjectId,BehaviourFactory> BehaviourFactoryMap;
@@ -120,11 +248,21 @@ private:
 
 	BufferRefMap buffers_;
 
-	/// the thread id for the diskstream loading thread
-	pthread_t diskstreamThreadId_;
+	/// the diskstream loading threads
+	std::vector<pthread_t> diskstreamThreads_;
 	pthread_mutex_t diskstreamThreadLock_;
-	pthread_cond_t  diskstreamThreadReady_;
+	sem_t diskstreamWake_; ///< posted by the process callback once a block has been played, never blocks it
         bool diskstreamThreadContinue_;
+	bool diskstreamThreadStarted_;
+	DiskstreamVector diskReads_; ///< streams being read by a disk thread now, a stream is read by one thread at a time
+	int diskReadHolds_; ///< no read starts while this is above zero, see hold_disk_reads
+	pthread_cond_t diskReadDone_; ///< signalled as each read finishes
+
+	/// wait for the reads in flight to finish and start no more until release_disk_reads,
+	/// so a stream can be changed or swapped out. lock the disk thread mutex first!
+	void hold_disk_reads();
+	/// let the disk threads read again, lock the disk thread mutex first!
+	void release_disk_reads();
 
 
 	LadspaHost* ladspaHost;
@@ -140,6 +278,12 @@ private:
 	static int lo_play(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 	static int lo_stop(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 	static int lo_seek(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+	static int lo_diskstream_stats(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+	static int lo_param_queue_stats(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+	static int lo_timed_queue_stats(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+	static int lo_reload(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+	static int lo_stats(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+	static int lo_meters_subscribe(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 
 	/// diskstream play
 	void diskstream_play();
@@ -148,9 +292,19 @@ private:
 	/// diskstream seek
 	void diskstream_seek(size_t pos);
 public:
-	/// reset everything and load from xml - ideally we do this with a new session object
+	/// load from xml. when a session is already running the new graph is built alongside it,
+	/// unchanged objects are carried over and the dsp thread switches over at a block boundary.
+	/// throws if the xml cannot be built, in which case the running session is left untouched.
 	void load_from_xml(const xmlpp::Node* node);
 
+	/// parse an xml file and load it, failures are reported and the running session carries on
+	void reload_from_file(const std::string& path);
+
+	/// ask for the input xml to be reloaded, safe to call from a signal handler
+	void request_reload(){ reloadRequested_ = true; }
+	/// carry out a requested reload, called periodically by the main thread
+	void poll_reload();
+
 	/// create a behaviour by xml node
 	Behaviour* create_behaviour_from_node(const xmlpp::Node* node);
 
@@ -170,15 +324,20 @@ public:
 	Loudspeaker* resolve_loudspeaker(ObjectId id);
 
 	/// builds the fast index tables of various dsp related objects
-	void build_dsp_object_lookups();
+	/// and compiles the behaviours into a dependency ordered dsp program
+	DspProgram* build_dsp_object_lookups(LoudspeakerVector& loudspeakers, DiskstreamVector& diskstreams);
 
 	/// jack dsp callback
 	virtual int on_process(jack_nframes_t nframes);
+	/// jack buffer size callback, asks for the session to be rebuilt for the new size
+	virtual int on_buffer_size(jack_nframes_t nframes);
 	
 	/// send osc relating to regular feedback to any listening clients
-	/// this should be called periodicaly by a thread
-	/// sends vu metering osc for each loudspeaker and audiostream.
+	/// this should be called by a thread options.meterRate_ times a second.
+	/// each client gets one bundle of the vu meters it subscribed to that changed since it was last sent them.
 	void send_osc_feedback();
+	/// a client stopped pinging, forget its meter subscription
+	virtual void on_client_expired(const std::string& url);
 
 
         /// register an audio buffer with a name such that it can be looked up
@@ -187,12 +346,50 @@ public:
         /// lookup_buffer
         BufferRefVector lookup_buffer(ObjectId id);
 
+	/// the options the session was started with
+	const CLIOptions& get_options() const {return options_;}
+
+	/// the queue osc parameter changes are posted to
+	ParamQueue& get_param_queue(){return paramQueue_;}
+
+	/// the pool session audio buffers are allocated from, only while loading
+	BufferArena& get_buffer_arena(){return bufferArena_;}
+
+	/// the loudspeakers of the running session in document order
+	const std::vector<Loudspeaker*>& get_loudspeakers(){return loudspeakers_;}
+	/// the diskstreams of the running session
+	const std::vector<Diskstream*>& get_diskstreams(){return diskStreams_;}
+	/// a jack port created by the session, or null
+	JackPort* get_port(ObjectId id);
+
+	/// read every diskstream until it holds a block, used instead of the disk thread when offline
+	void fill_diskstreams(jack_nframes_t nframes);
+
+	/// give a parameter its osc address, deferred until a load in progress completes
+	void register_parameter_address(BParam* param);
+
+	/// create a jack port for an object, a port left by the object being replaced is reused
+	JackPort* create_port(ObjectId id, JackPortFlags flags);
+
+	/// queue a parameter change for the frame matching an osc timetag, called from the osc thread
+	void schedule_parameter(BParam* param, float value, lo_timetag when);
+
+	/// convert an osc timetag to the jack frame it falls on
+	jack_nframes_t timetag_to_frame(lo_timetag when);
+
 	/// get the ladsdpa descriptor manager
 	LadspaHost& get_ladspa_host(){return *ladspaHost;}
 
 private:
-	/// check disk input buffers are full and cause a load if they are not
-	/// called by the disk input thread, syncronised by the process thread.
+	/// true if an unchanged object can be carried over into the session being loaded
+	bool can_reuse(DynamicObject* ob, const ObjectIdSet& dependencies, const DynamicObjectMap& oldObjects);
+	/// hand a new program to the dsp thread and wait for it to switch
+	void swap_program(DspProgram* program);
+	/// wait for the dsp thread to complete a number of blocks
+	void wait_for_blocks(unsigned int count);
+
+	/// keep the diskstreams read ahead, the one nearest to running dry is read first.
+	/// called by the disk input thread, woken by the process thread.
 	void diskstream_process();
 	static void* diskstream_thread (void *arg);
 };
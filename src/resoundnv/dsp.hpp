@@ -21,22 +21,43 @@
 #include <cassert>
 #include <cstring>
 #include <cmath>
+#include <string>
 
 const float PI=3.14159;
 const float TWOPI=2.0f*PI;
 const float HALFPI=0.5f*PI;
 
+class BufferArena;
+
 /// memory managed audio buffer
 class AudioBuffer {
 	size_t size_;
-	float* buffer_;
+	float* buffer_; ///< the samples, storage_ unless aliased
+	float* storage_; ///< the samples owned by this buffer
+	float readGain_; ///< gain a reader must apply, only not unity while aliasing unscaled samples
+	bool silent_; ///< the frames of the current (sub) block are all zero
+	BufferArena* arena_; ///< where storage_ came from, null if from the heap
 public:
 	AudioBuffer();
 	~AudioBuffer();
-	void allocate( size_t size );
+	/// allocate from a session arena, or 64 byte aligned from the heap if arena is null
+	void allocate( size_t size, BufferArena* arena = 0 );
 	void clear();
+	void clear(size_t nframes); ///< clear only the first nframes, for aliased buffers
+	/// zero frames [offset, offset+nframes) and mark them silent
+	void silence(size_t offset, size_t nframes);
 	void destroy();
 	float* get_buffer(){return buffer_;}
+	size_t get_size() const {return size_;}
+	/// use memory owned by someone else, e.g. a jack port buffer, until the next call.
+	/// null goes back to the buffers own storage. only the dsp thread may alias a buffer in use.
+	/// readGain is the gain the samples should have had, readers that can apply it do so in their own gain.
+	void alias(float* buffer, float readGain = 1.0f){ buffer_ = buffer ? buffer : storage_; readGain_ = readGain; }
+	float get_read_gain() const {return readGain_;}
+	/// whoever writes the buffer says whether the (sub) block it wrote is silent, readers may then skip it.
+	/// a producer sets it for every block it writes, summing anything audible into a bus clears it.
+	bool is_silent() const {return silent_;}
+	void set_silent(bool silent){ silent_ = silent; }
 	//float& operator [](unsigned int n){return buffer_[n];};
 	//float* operator *
 
@@ -44,10 +65,80 @@ public:
 
 // operations on buffers
 
+/// one source summed into a bus by DspKernels::mix.
+/// frame n of the ramp is scaled by start + step * min(n, rampFrames), every frame after it by gain,
+/// which must be start + step * rampFrames. a term that does not ramp has rampFrames and step zero.
+struct MixTerm {
+	const float* src;
+	float start;
+	float step;
+	float gain;
+	float rampFrames;
+};
+
+/// one implementation of the buffer kernels, see dspkernels.cpp
+struct DspKernels {
+	const char* name;
+	void (*copy_with_gain)(const float* src, float* dest, size_t N, float gain);
+	void (*sum_with_gain)(const float* src, float* dest, size_t N, float gain);
+	void (*sum_with_gain_linear_interp)(const float* src, float* dest, size_t N, float gain, float oldGain, size_t interpSize);
+	/// sum count terms into frames [offset+begin, offset+end) of dest, the ramps cover frames [offset, offset+rampEnd),
+	/// rampEnd must be at least the rampFrames of every term.
+	/// dest is read and written once per frame whatever the number of terms, the sum is kept in registers
+	void (*mix)(const MixTerm* terms, size_t count, float* dest, size_t offset, size_t begin, size_t end, size_t rampEnd);
+	/// the largest magnitude and the sum of squares of N samples, in one pass
+	void (*peak_and_squares)(const float* src, size_t N, float* peak, float* sumOfSquares);
+	/// split frames of interleaved channels into one buffer per channel.
+	/// memory bound, every wider set uses the sse2 version
+	void (*deinterleave)(const float* src, float* const* dest, size_t channels, size_t frames);
+};
+/// the kernels in use, scalar until dsp_select_kernels is called
+extern DspKernels g_dspKernels;
+
+/// pick the kernels by name: "auto" (the widest the cpu supports), "avx512", "avx2", "sse2" or "scalar".
+/// returns false if the name is unknown or the cpu cannot run them, the kernels in use are kept.
+/// must not be called while the dsp is running.
+bool dsp_select_kernels(const std::string& name);
+
 void ab_copy(const float* src, float* dest, size_t N );
-void ab_copy_with_gain(const float* src, float* dest, size_t N, float gain);
-void ab_sum_with_gain(const float* src, float* dest, size_t N, float gain);
-void ab_sum_with_gain_linear_interp(const float* src, float* dest, size_t N, float gain, float oldGain, size_t interpSize);
+inline void ab_copy_with_gain(const float* src, float* dest, size_t N, float gain){
+	g_dspKernels.copy_with_gain(src, dest, N, gain);
+}
+inline void ab_sum_with_gain(const float* src, float* dest, size_t N, float gain){
+	g_dspKernels.sum_with_gain(src, dest, N, gain);
+}
+/// sum with the gain ramped from oldGain to gain over the first interpSize frames
+inline void ab_sum_with_gain_linear_interp(const float* src, float* dest, size_t N, float gain, float oldGain, size_t interpSize){
+	g_dspKernels.sum_with_gain_linear_interp(src, dest, N, gain, oldGain, interpSize);
+}
+/// sum with the gain ramped from start by step for rampFrames frames, it then holds at start + step * rampFrames.
+/// without a ramp this is a plain ab_sum_with_gain, see SmoothedValue::advance
+inline void ab_sum_with_gain_ramp(const float* src, float* dest, size_t N, float start, float step, size_t rampFrames){
+	if(rampFrames == 0){
+		ab_sum_with_gain(src, dest, N, start);
+	} else {
+		ab_sum_with_gain_linear_interp(src, dest, N, start + step * (float)rampFrames, start, rampFrames);
+	}
+}
+/// true if all N samples are zero, audio exits on its first sample so only silence is read in full
+inline bool ab_is_silent(const float* src, size_t N){
+	for(size_t n = 0; n < N; ++n){
+		if(src[n] != 0.0f) return false;
+	}
+	return true;
+}
+/// block figures for metering, see DspKernels::peak_and_squares
+inline void ab_peak_and_squares(const float* src, size_t N, float& peak, float& sumOfSquares){
+	g_dspKernels.peak_and_squares(src, N, &peak, &sumOfSquares);
+}
+/// interleaved frames from a sound file into one buffer per channel, see DspKernels::deinterleave
+inline void ab_deinterleave(const float* src, float* const* dest, size_t channels, size_t frames){
+	g_dspKernels.deinterleave(src, dest, channels, frames);
+}
+/// sum several sources into one buffer, see DspKernels::mix
+inline void ab_mix(const MixTerm* terms, size_t count, float* dest, size_t offset, size_t begin, size_t end, size_t rampEnd){
+	g_dspKernels.mix(terms, count, dest, offset, begin, end, rampEnd);
+}
 
 class LookupTable{
 private:
@@ -119,6 +210,11 @@ public:
 		if(phase_>=1.0f){phase_ -= 1.0f; return;}
 		if(phase_<0.0f){phase_ += 1.0f;}
 	}
+	/// advance by a number of samples at once, for control rate use
+	void advance(float samples){
+		phase_ = std::fmod(phase_ + step_ * samples, 1.0f);
+		if(phase_<0.0f){phase_ += 1.0f;}
+	}
 	void set_freq(float freq){
 		assert(freq <= SR_); // beacause this would cause problems in the tick code
 		freq_ = freq;
@@ -129,35 +225,105 @@ public:
 	}
 };
 
-/// a vu metering class
+/// a value that moves to a new target in a straight line over a fixed time.
+/// the ramp carries on across (sub) blocks of any size and costs nothing once the target is reached.
+/// only the dsp thread may use it once running.
+class SmoothedValue {
+	float current_; ///< the value at the start of the next (sub) block
+	float target_;
+	float step_; ///< change per frame while ramping
+	size_t remaining_; ///< frames left in the ramp
+	size_t rampFrames_; ///< frames a whole ramp takes
+public:
+	SmoothedValue(float value = 0.0f) : current_(value), target_(value), step_(0.0f), remaining_(0), rampFrames_(0) {}
+	/// ramp time in milliseconds, zero steps straight to each new target
+	void set_ramp_time(float ms, float sampleRate){
+		rampFrames_ = ms > 0.0f ? (size_t)(ms * 0.001f * sampleRate + 0.5f) : 0;
+	}
+	size_t get_ramp_frames() const { return rampFrames_; }
+	/// ramp from wherever the value is now, a new target part way through a ramp starts a fresh one
+	void set_target(float target){
+		if(target == target_) return;
+		target_ = target;
+		if(rampFrames_ == 0){
+			jump(target);
+			return;
+		}
+		remaining_ = rampFrames_;
+		step_ = (target_ - current_) / (float)rampFrames_;
+	}
+	/// go straight to a value
+	void jump(float value){ current_ = target_ = value; remaining_ = 0; }
+	float get_value() const { return current_; }
+	float get_target() const { return target_; }
+	bool is_ramping() const { return remaining_ > 0; }
+	/// move on by a (sub) block of nframes. the value ramps from start by step over the returned
+	/// number of frames and holds after them, zero frames once the target is reached.
+	size_t advance(size_t nframes, float& start, float& step){
+		start = current_;
+		if(remaining_ == 0){
+			step = 0.0f;
+			return 0;
+		}
+		size_t frames = remaining_ < nframes ? remaining_ : nframes;
+		step = step_;
+		remaining_ -= frames;
+		current_ = remaining_ ? current_ + step_ * (float)frames : target_;
+		return frames;
+	}
+};
+
+/// a vu metering class, the ballistics run once per block on figures from ab_peak_and_squares
 class VUMeter{
 private:
-	int size_;
+	int size_; ///< frames in the rms window
 	float rms_;
 	float peak_;
 	float margin_;
 	float sumOfSquares_;
 	int count_;
+	int falloffFrames_; ///< the block length falloff_ was worked out for
+	float falloff_; ///< peak falloff over falloffFrames_
 public:
-	VUMeter(int size=4096) : //TODO the magic number here for buffer size implies a maximal jack buffer size of 4096
+	static const float PEAK_FALLOFF; ///< per frame
+
+	VUMeter(int size=4096) :
 		size_(size), 
 		rms_(0.0f), 
 		peak_(0.0f), 
 		margin_(0.0f), 
 		sumOfSquares_(0.0f), 
-		count_(0){}
-	void analyse_buffer(float* buffer, int N){
-		for(int n=0; n<N; ++n){
-			float v = buffer[n];
-			float magv = std::abs(v);
-			sumOfSquares_ += v*v;
-			peak_ = peak_ < magv ? magv : peak_;
-			peak_ *= 0.9999; /// peak falloff
-			margin_ = margin_ < magv ? magv : margin_;
-			++count_;
+		count_(0),
+		falloffFrames_(0),
+		falloff_(1.0f){}
+	/// the rms is over a window of this many frames, whatever the block size
+	void set_window(int size){ size_ = size > 0 ? size : 1; }
+	void analyse_buffer(const float* buffer, int N){
+		float peak, sumOfSquares;
+		ab_peak_and_squares(buffer, N, peak, sumOfSquares);
+		analyse_block(peak, sumOfSquares, N);
+	}
+	/// the same as analysing N zero samples
+	void analyse_silence(int N){
+		analyse_block(0.0f, 0.0f, N);
+	}
+	/// take in a block of N frames with its largest magnitude and sum of squares
+	void analyse_block(float peak, float sumOfSquares, int N){
+		// blocks are nearly always the same length, the falloff is only worked out when it changes
+		if(N != falloffFrames_){
+			falloff_ = std::pow(PEAK_FALLOFF, N);
+			falloffFrames_ = N;
 		}
+		peak_ *= falloff_;
+		peak_ = peak_ < peak ? peak : peak_;
+		margin_ = margin_ < peak ? peak : margin_;
+		sumOfSquares_ += sumOfSquares;
+		count_ += N;
+		update_rms();
+	}
+	void update_rms(){
 		if(count_ >= size_){
-			rms_ = std::sqrt(sumOfSquares_/float(size_));
+			rms_ = std::sqrt(sumOfSquares_/float(count_));
 			sumOfSquares_ = 0.0f;
 			count_ = 0;
 		}
@@ -0,0 +1,134 @@
+//    Resound
+//    Copyright 2009 David Moore and James Mooney
+//
+//    This file is part of Resound.
+//
+//    Resound is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    Resound is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Resound; if not, write to the Free Software
+//    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+#pragma once
+
+#include "resound_types.hpp"
+#include "behaviour.hpp"
+#include "parallel.hpp"
+#include "mixmatrix.hpp"
+#include "dspstats.hpp"
+#include "meterbank.hpp"
+
+/// one instruction of a compiled dsp program
+struct DspOp {
+	DspProcessFunc func;
+	void* object;
+	DspOp(DspProcessFunc f, void* o) : func(f), object(o) {}
+};
+
+/// the dsp graph of a session compiled into a flat list of calls.
+/// built once at load time, the process callback only walks the op list.
+class DspProgram {
+public:
+	typedef std::vector<Behaviour*> BehaviourVector;
+	typedef std::vector<Loudspeaker*> LoudspeakerVector;
+	typedef std::vector<DspOp> DspOpVector;
+private:
+	LoudspeakerVector loudspeakers_;
+	BehaviourVector behaviours_; ///< live behaviours in execution order
+	BehaviourVector pruned_; ///< behaviours whose output reaches no loudspeaker
+	std::vector<Livestream*> aliasedInputs_; ///< livestreams read straight from their capture port, no op is run
+	std::vector<Livestream*> copiedInputs_; ///< livestreams copying their capture port in process
+	DspOpVector ops_; ///< the ops of allOps_ whose behaviour is not bypassed
+	DspOpVector allOps_; ///< one per behaviour
+	bool bypassChanged_; ///< ops_ must be refiltered at the next block
+	DspSchedule* schedule_; ///< parallel plan, null when running serially
+	MixMatrix* matrix_; ///< sums the routes of the routeset behaviours, null if none or a behaviour reads a bus
+
+	/// a behaviour buffer and the shared storage it uses while the program runs.
+	/// buffers whose lifetimes do not overlap share storage, so fewer distinct buffers are touched per block
+	struct BufferMapping {
+		AudioBuffer* buffer;
+		Behaviour* producer;
+		int index; ///< of the buffer in its producer
+		int first; ///< step (op or level) writing it
+		int last; ///< last step reading it
+		int storage; ///< index into storage_, -1 for the buffers own
+	};
+	std::vector<BufferMapping> mappings_; ///< every buffer of the programs behaviours except livestreams
+	std::vector<float*> storage_; ///< shared buffers from the session arena
+	size_t storageSize_; ///< frames in each shared buffer
+	bool remap_; ///< the buffers must be pointed at their storage before the next block
+	jack_nframes_t blockSize_; ///< the buffers hold blocks up to this size
+
+	DspStats stats_;
+	MeterBank meters_; ///< the loudspeaker buses and the buffers of metered behaviours
+	std::vector<DspTimer*> opTimers_; ///< one per op
+	std::vector<DspTimer*> allOpTimers_; ///< one per behaviour
+	std::vector<DspTimer*> loudspeakerTimers_; ///< one per loudspeaker
+	/// work out buffer lifetimes and give buffers that are never live at once the same storage
+	void plan_buffers();
+	/// point every buffer at its storage, bypassed producers keep their own
+	void map_buffers();
+public:
+	/// compile the behaviours into dependency order.
+	/// behaviours should be given in document order, it is used to break ties.
+	/// if pool is not null a parallel schedule is planned for it.
+	DspProgram(const BehaviourVector& behaviours, const LoudspeakerVector& loudspeakers, DspWorkerPool* pool);
+	~DspProgram();
+
+	/// start a block: apply bypass changes, point livestreams at their capture ports and clear the loudspeaker buses
+	void pre_process(jack_nframes_t nframes);
+
+	/// process frames [offset, offset+nframes) of the block.
+	/// the pool must be the one given at compile time
+	void process(DspWorkerPool* pool, jack_nframes_t offset, jack_nframes_t nframes){
+		if(schedule_){
+			schedule_->process(*pool, offset, nframes);
+			return;
+		}
+		const DspOp* op = ops_.empty() ? 0 : &ops_[0];
+		const DspOp* end = op + ops_.size();
+#ifdef RESOUND_DSP_STATS
+		DspTimer* const* timer = opTimers_.empty() ? 0 : &opTimers_[0];
+		DSP_TIMER_START(t);
+		for(; op != end; ++op, ++timer){
+			op->func(op->object, offset, nframes);
+			DSP_TIMER_LAP(t, *timer);
+		}
+#else
+		for(; op != end; ++op){
+			op->func(op->object, offset, nframes);
+		}
+#endif
+	}
+
+	/// finish a block, writing the loudspeaker buses out
+	void post_process(DspWorkerPool* pool, jack_nframes_t nframes);
+
+	/// the largest block the buffers were cut for, the session buffer size when compiled
+	jack_nframes_t get_block_size() const { return blockSize_; }
+	/// write silence to every loudspeaker port, in place of a block too large to process
+	void silence_outputs(jack_nframes_t nframes);
+
+	const BehaviourVector& get_behaviours() const { return behaviours_; }
+	const LoudspeakerVector& get_loudspeakers() const { return loudspeakers_; }
+
+	/// per object timings, only filled in when built with RESOUND_DSP_STATS
+	const DspStats& get_stats() const { return stats_; }
+
+	/// the meters of this program, read by the feedback thread
+	MeterBank& get_meters() { return meters_; }
+
+	/// the number of distinct buffers the behaviours touch per block, after reuse
+	size_t get_storage_count() const { return storage_.size(); }
+
+	/// print the execution order and buffer mapping for debugging
+	void print();
+};
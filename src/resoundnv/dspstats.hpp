@@ -0,0 +1,130 @@
+//    Resound
+//    Copyright 2009 David Moore and James Mooney
+//
+//    This file is part of Resound.
+//
+//    Resound is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    Resound is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Resound; if not, write to the Free Software
+//    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+#include <time.h>
+
+/// a raw timestamp, cpu cycles where the time stamp counter is available, otherwise nanoseconds
+typedef uint64_t dsp_cycles_t;
+
+/// read the cheapest clock available, safe to call from the dsp thread
+inline dsp_cycles_t dsp_read_cycles(){
+#if defined(__i386__) || defined(__x86_64__)
+	uint32_t lo, hi;
+	__asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((dsp_cycles_t)hi << 32) | lo;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (dsp_cycles_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/// how many dsp_read_cycles units make up a microsecond, measured once on first use
+double dsp_cycles_per_usec();
+
+// timing hooks for the dsp thread, these compile to nothing unless RESOUND_DSP_STATS is defined
+#ifdef RESOUND_DSP_STATS
+/// start a chain of timings
+#define DSP_TIMER_START(t) dsp_cycles_t t = dsp_read_cycles()
+/// charge the time since the last lap to a timer owned by this thread
+#define DSP_TIMER_LAP(t, timer) do { dsp_cycles_t now_ = dsp_read_cycles(); (timer)->add(now_ - t); t = now_; } while(0)
+/// charge the time since the last lap to a timer other threads may be charging too
+#define DSP_TIMER_LAP_SHARED(t, timer) do { dsp_cycles_t now_ = dsp_read_cycles(); (timer)->add_shared(now_ - t); t = now_; } while(0)
+#else
+#define DSP_TIMER_START(t)
+#define DSP_TIMER_LAP(t, timer)
+#define DSP_TIMER_LAP_SHARED(t, timer)
+#endif
+
+/// the rolling figures for one timer, in microseconds per block
+struct DspTimerSummary {
+	std::string name;
+	float min;
+	float mean;
+	float max;
+	float p99;
+	unsigned int blocks; ///< how many blocks the figures cover
+};
+
+/// time spent by one dsp object in each of the last few blocks.
+/// the dsp thread accumulates into the current block and files it at the end of the block,
+/// readers copy the history without locking, at worst a block being filed is seen half written.
+class DspTimer {
+public:
+	static const unsigned int HISTORY = 256; ///< blocks kept, must be a power of two
+private:
+	std::string name_;
+	volatile dsp_cycles_t current_;
+	uint32_t history_[HISTORY];
+	volatile unsigned int count_;
+public:
+	DspTimer(const std::string& name);
+
+	const std::string& get_name() const { return name_; }
+
+	/// dsp side, add to the current block
+	void add(dsp_cycles_t cycles){ current_ += cycles; }
+	/// dsp side, add to the current block from one of several threads
+	void add_shared(dsp_cycles_t cycles){ __sync_fetch_and_add(&current_, cycles); }
+	/// dsp side, file the current block
+	void end_block(){
+		history_[count_ & (HISTORY - 1)] = (uint32_t)current_;
+		current_ = 0;
+		__sync_synchronize(); // the sample before the count
+		++count_;
+	}
+
+	/// any thread, work out min, mean, max and 99th percentile over the history
+	void summarise(DspTimerSummary& summary) const;
+};
+
+/// every timer of a compiled dsp program
+class DspStats {
+	typedef std::vector<DspTimer*> TimerVector;
+	TimerVector timers_;
+	typedef std::map<const void*, DspTimer*> TimerMap;
+	TimerMap objects_;
+	DspTimer* block_; ///< the whole block from pre_process to post_process
+	dsp_cycles_t blockStart_;
+public:
+	DspStats();
+	~DspStats();
+
+	/// create a timer for an object, called while compiling
+	DspTimer* add_timer(const void* object, const std::string& name);
+	/// the timer of an object, or null if it has none
+	DspTimer* get_timer(const void* object);
+
+	/// dsp side, mark the start and end of a block
+	void begin_block(){ blockStart_ = dsp_read_cycles(); }
+	void end_block(){
+		block_->add(dsp_read_cycles() - blockStart_);
+		for(unsigned int n = 0; n < timers_.size(); ++n){
+			timers_[n]->end_block();
+		}
+	}
+
+	/// any thread, a summary of every timer, the block first
+	void summarise(std::vector<DspTimerSummary>& summaries) const;
+};
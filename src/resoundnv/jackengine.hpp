@@ -26,6 +26,7 @@
 #include <list>
 #include <cassert>
 #include <set>
+#include <vector>
 #include <pthread.h>
 #include <iostream>
 
@@ -33,12 +34,15 @@ class JackEngine;
 
 typedef std::list<std::string> JackPortNameList;
 
-/// automagic registration and deregistration of jack ports
+/// automagic registration and deregistration of jack ports.
+/// when the engine is offline the port is just a buffer the size of a block
 class JackPort{
 	JackEngine* m_jack;
 	jack_port_t* m_port;
+	std::vector<float> m_buffer; ///< the port buffer when offline
 	std::string m_name;
 	JackPortFlags m_flags;
+	JackPortNameList m_connections; ///< the connections made through this object
 public:
 	JackPort(std::string id, JackPortFlags flags, JackEngine* jack);
 	virtual ~JackPort();
@@ -46,6 +50,8 @@ public:
 	void connect(std::string portName);
 	void disconnect(std::string portName);
 	void disconnect_all();
+	JackPortFlags get_flags() const { return m_flags; }
+	const JackPortNameList& get_connections() const { return m_connections; }
 };
 
 /// an abstract base class for using jack in a class
@@ -58,11 +64,20 @@ private:
 	jack_nframes_t m_bufferSize; ///< the current bufferSize
 	jack_nframes_t m_sampleRate; ///< the current sample rate
 
-	bool m_dspIsRunning;
+	volatile bool m_dspIsRunning; ///< cleared by stop, or by jack shutting the client down
+
+	bool m_offline; ///< no jack server, the owner calls process_offline itself
+	jack_nframes_t m_frameTime; ///< frames processed so far when offline
 public:
 	JackEngine();
 	virtual ~JackEngine();
 	void init(const std::string name);
+	/// run without a jack server at a fixed buffer size and sample rate,
+	/// ports become plain buffers and nothing is processed until process_offline is called
+	void init_offline(const std::string name, jack_nframes_t bufferSize, jack_nframes_t sampleRate);
+	bool is_offline(){return m_offline;}
+	/// process one block when offline, standing in for the jack process thread
+	int process_offline();
 	void start();
 	void stop();
 	void close();
@@ -71,6 +86,7 @@ public:
 	virtual void on_start(){}; // prior to start
 	virtual void on_stop(){}; // post stoped
 	virtual void on_close(){}; // post closed
+	virtual void on_shutdown(){}; // jack has gone or dropped the client, process will not be called again
 
 	// these are virtualized versions of the callbacks
 	virtual int on_buffer_size(jack_nframes_t nframes){  return 0; }
@@ -92,8 +108,16 @@ public:
 	/// return a list of ports
 	void get_ports(JackPortNameList& portList,const std::string& portNamePattern, const std::string& typeNamePattern);
 
+	/// create a thread scheduled like the jack process thread, realtime if jack is
+	int create_thread(pthread_t* thread, void *(*func)(void*), void* arg);
+
 	jack_nframes_t get_buffer_size() { return m_bufferSize; }
 	jack_nframes_t get_sample_rate() { return m_sampleRate; }
+
+	/// estimated current frame, callable from any thread
+	jack_nframes_t get_frame_time() { return m_offline ? m_frameTime : jack_frame_time(m_jc); }
+	/// the frame at the start of the current block, only meaningful in the process callback
+	jack_nframes_t get_last_frame_time() { return m_offline ? m_frameTime : jack_last_frame_time(m_jc); }
 private: 
 	/// jack static callbacks
 	static int jack_buffer_size_callback(jack_nframes_t nframes, void *arg);
@@ -106,6 +130,7 @@ private:
 	static int jack_sample_rate_callback(jack_nframes_t nframes, void *arg);
 	static void jack_thread_init_callback(void *arg);
 	static int jack_xrun_callback(void *arg);
+	static void jack_shutdown_callback(void *arg);
 	
 };
 
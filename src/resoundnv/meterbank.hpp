@@ -0,0 +1,68 @@
+//    Resound
+//    Copyright 2009 David Moore and James Mooney
+//
+//    This file is part of Resound.
+//
+//    Resound is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    Resound is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Resound; if not, write to the Free Software
+//    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+#pragma once
+
+#include "resound_types.hpp"
+#include "dsp.hpp"
+#include <string>
+#include <vector>
+
+/// the figures of one meter as the feedback thread sees them
+struct MeterReading {
+	float rms;
+	float peak;
+	float margin;
+};
+
+/// every meter of a compiled dsp program, analysed together once a block after all the dsp is done.
+/// the dsp thread takes the peak and sum of squares of each buffer in one pass, runs the ballistics
+/// once per buffer and publishes the readings through a triple buffer. the feedback thread takes
+/// the latest set without locking, it never sees one half written and never holds up the dsp thread.
+class MeterBank {
+	struct Channel {
+		std::string name; ///< the osc address the reading is sent on
+		AudioBuffer* buffer;
+		VUMeter* meter; ///< owned by the metered object so the ballistics carry over a reload
+		bool bus; ///< the silent flag covers the whole block, not only the last sub block
+	};
+	std::vector<Channel> channels_;
+	static const int FRESH = 4; ///< set in middle_ while the reader has not taken it
+	std::vector<MeterReading> slots_[3];
+	int back_; ///< dsp side, the slot being written
+	volatile int middle_; ///< the slot last published
+	int front_; ///< reader side, the slot last taken
+public:
+	static const int WINDOW_MS = 85; ///< the rms window, 4096 frames at 48kHz as it always was
+
+	MeterBank();
+
+	/// meter a buffer, called while compiling
+	void add(const std::string& name, AudioBuffer* buffer, VUMeter* meter, bool bus);
+	/// size the readings once every buffer is added, the rms of each meter covers windowFrames
+	void finalise(int windowFrames);
+
+	size_t size() const { return channels_.size(); }
+	const std::string& get_name(size_t n) const { return channels_[n].name; }
+
+	/// dsp side, meter the block and publish the readings
+	void process(jack_nframes_t nframes);
+	/// reader side, the latest readings, one per meter in the order they were added.
+	/// false if nothing was published since the last call. only one thread may read.
+	bool read(const MeterReading*& readings);
+};
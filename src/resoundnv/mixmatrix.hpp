@@ -0,0 +1,84 @@
+//    Resound
+//    Copyright 2009 David Moore and James Mooney
+//
+//    This file is part of Resound.
+//
+//    Resound is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    Resound is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Resound; if not, write to the Free Software
+//    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+#pragma once
+
+#include "resound_types.hpp"
+#include "behaviour.hpp"
+
+/// the routes of the routeset behaviours in a dsp program summed as one sparse matrix
+/// of source buffers by loudspeaker buses.
+/// the behaviours only set their route levels at control rate, the matrix then sums every
+/// route into a bus in one pass so each bus is read and written once per block rather than
+/// once per route. frames are taken a tile at a time across all buses, a tile of every source
+/// stays in cache while it is summed into each bus that uses it.
+/// the routes into a bus are summed in the order the behaviours would have summed them.
+class MixMatrix : public Behaviour {
+public:
+	typedef std::vector<Behaviour*> BehaviourVector;
+	typedef std::set<Behaviour*> BehaviourSet;
+	/// frames per tile, a tile of 24 sources is 12k
+	static const size_t TILE_FRAMES = 128;
+private:
+	/// a route and the term summing it
+	struct Entry {
+		BRoute* route;
+		size_t term; ///< index into terms_
+	};
+	/// the terms summed into one bus, terms_[first, last).
+	/// those with anything to add this block are packed into active_[first, activeLast) by the lane owning the bus
+	struct Column {
+		AudioBuffer* bus;
+		size_t first;
+		size_t last;
+		size_t activeLast;
+		int lane;
+	};
+	std::vector<Entry> entries_;
+	std::vector<MixTerm> terms_; ///< grouped by bus
+	std::vector<const AudioBuffer*> sources_; ///< the source of each term
+	std::vector<MixTerm> active_; ///< terms with a source that is not silent and a gain that is not zero
+	std::vector<Column> columns_;
+	BehaviourSet mixed_;
+	size_t rampEnd_; ///< frames of the current (sub) block inside the longest ramp
+public:
+	/// true if a matrix can sum the routes of these behaviours, no behaviour may read a bus
+	/// because the matrix sums every route after all of them have run
+	static bool can_mix(const BehaviourVector& behaviours, const AudioBufferSet& buses);
+
+	/// take over the routes of every behaviour that supports it, behaviours must be in serial order
+	MixMatrix(const BehaviourVector& behaviours);
+
+	/// true if the routes of b are summed here, b should then only be given process_control
+	bool mixes(Behaviour* b) const { return mixed_.count(b) > 0; }
+	const BehaviourSet& get_mixed() const { return mixed_; }
+	size_t get_route_count() const { return entries_.size(); }
+
+	virtual void process(jack_nframes_t offset, jack_nframes_t nframes);
+	virtual DspProcessFunc get_process_func() { return dsp_process_thunk<MixMatrix>; }
+	/// every route source is read, every bus with a route is written
+	virtual void get_buffer_usage(AudioBufferSet& reads, AudioBufferSet& writes);
+	virtual bool supports_bus_lanes() { return true; }
+	virtual void assign_bus_lanes(const BusLaneMap& lanes);
+	/// pick up the route levels the behaviours set and move their ramps on, must follow their process_control
+	virtual void process_control(jack_nframes_t offset, jack_nframes_t nframes);
+	virtual void process_lane(jack_nframes_t offset, jack_nframes_t nframes, int lane);
+
+	/// print the matrix size for debugging
+	void print();
+};
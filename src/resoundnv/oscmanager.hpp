@@ -23,6 +23,10 @@
 #include <lo/lo.h> // liblo OSC
 #include <string>
 #include <map>
+#include <vector>
+#include <pthread.h>
+#include <time.h>
+#include <stdint.h>
 
 namespace Resound{
 
@@ -37,7 +41,44 @@ struct ActiveClient{
 	lo_address returnAddress; 
 	size_t addressSize;
 
-	ActiveClient() : timeToLive(0), returnPort(0), addressSize(0) {}
+	ActiveClient() : timeToLive(0), returnPort(0), returnAddress(0), addressSize(0) {}
+};
+
+/// the active clients at one moment. a snapshot never changes once published,
+/// a new one replaces it whenever a client comes or goes.
+struct ClientSnapshot {
+	std::vector<ActiveClient> clients;
+	std::vector<lo_address> retired; ///< return addresses the next snapshot dropped, freed along with this one
+};
+
+/// a handler taking messages for an address, several may share one address
+struct OSCTarget {
+	lo_method_handler handler;
+	void* userData;
+};
+
+/// every address taken by the catch all handler, hashed once when built and never changed after.
+/// open addressing with linear probing, kept at most half full so a lookup costs one hash and a probe or two
+class OSCAddressTable {
+	struct Entry {
+		std::string path;
+		uint32_t hash;
+		std::vector<OSCTarget> targets;
+	};
+	std::vector<Entry> entries_;
+	std::vector<int> slots_; ///< index into entries_, -1 for an empty slot
+	uint32_t mask_;
+	std::vector<int> handleEntries_; ///< index into entries_ by handle, -1 for an address with no targets now
+public:
+	typedef std::map<std::string, std::vector<OSCTarget> > TargetMap;
+	typedef std::map<std::string, int> HandleMap;
+	OSCAddressTable(const TargetMap& targets, const HandleMap& handles);
+	/// the targets of an address, null if it has none
+	const std::vector<OSCTarget>* find(const char* path) const;
+	/// the targets of an address by its handle, null if it has none
+	const std::vector<OSCTarget>* find(int handle, const char*& path) const;
+	/// FNV-1a over the address
+	static uint32_t hash(const char* path);
 };
 
 class OSCManager{
@@ -50,28 +91,82 @@ public:
 	static int lo_cb_generic(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 	static int lo_cb_syn(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 	static int lo_cb_ack(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+	/// takes every message and hands it to the targets of its address in the address table
+	static int lo_cb_dispatch(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+	/// /resound/params, a batch of (handle, value) pairs as a blob or as int float arguments
+	static int lo_cb_batch(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+	/// /resound/params/handles, replies with the handle of each address asked for
+	static int lo_cb_handles(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 	/// call this to every second or so to update the client list
 	/// any clients that have failed to send a ping recently will be removed
 	void update_clients();
+	/// call this often, it runs update_clients once every EXPIRY_INTERVAL seconds
+	void poll_expiry();
+	static const int EXPIRY_INTERVAL = 1;
+	static const int TIME_TO_LIVE = 5; ///< intervals without a ping before a client is dropped
 
 	/// have received a ping from the osc url specified
 	/// overriders should call the base class first
 	virtual void recv_syn(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 	virtual void recv_ack(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+	/// a client has been dropped from the active list, called by update_clients without the client lock
+	virtual void on_client_expired(const std::string& url){};
 
 	/// register a handler function for an osc address
 	/// simply a wrapper over the liblo version
 	/// lo_server_thread_add_method(...);
 	void add_method(std::string path, std::string typeSpec, lo_method_handler handler, void* userData);
+	/// the same accepting any arguments, the handler checks the types
+	void add_method(std::string path, lo_method_handler handler, void* userData);
+
+	/// lo_server_thread_del_method(...);
+	void del_method(std::string path, std::string typeSpec);
+
+	/// hand messages for path to handler through the address table rather than a liblo method of its own,
+	/// lookups stay one hash however many addresses there are. any number of targets may share a path,
+	/// the handler checks the types. nothing changes for incoming messages until publish_targets.
+	void add_target(const std::string& path, lo_method_handler handler, void* userData);
+	/// stop handing messages for path to the target with this userData
+	void remove_target(const std::string& path, void* userData);
+	/// build a new address table from the targets and swap it in, once after a batch of changes
+	void publish_targets();
+	/// the handle of an address for /resound/params, -1 if it has never had a target
+	int get_handle(const std::string& path);
 
 	/// variable args method wrapper around liblos lo_send
 	void send_osc_to_all_clients(const char* addr, const char* format, ... );
+
+	/// the current clients, for feedback that differs from client to client. never blocks or allocates,
+	/// the snapshot and its return addresses stay valid until release_clients
+	const ClientSnapshot& acquire_clients();
+	void release_clients();
 private:
 	// OSC
 	lo_server_thread m_loServerThread; ///< the liblo server thread
 
 	typedef std::map<std::string, ActiveClient> ActiveClientMap;
-	ActiveClientMap m_clients; ///< managed map of active clients .. ie ones that are pinging
+	ActiveClientMap m_clients; ///< managed map of active clients .. ie ones that are pinging, owns their return addresses
+	/// held by whoever changes m_clients, the liblo thread on a ping and the thread polling expiry. readers never take it
+	pthread_mutex_t m_clientLock;
+	ClientSnapshot* volatile m_snapshot; ///< what readers see
+	std::vector<ClientSnapshot*> m_retiredSnapshots; ///< replaced but perhaps still being read
+	volatile int m_readers; ///< threads between acquire_clients and release_clients
+	struct timespec m_lastExpiry;
+
+	/// make m_clients what readers see, the addresses dropped from it are freed once no reader can hold them.
+	/// m_clientLock must be held
+	void publish_clients(std::vector<lo_address>& dropped);
+	/// free replaced snapshots if nobody is reading, m_clientLock must be held
+	void free_retired();
+
+	OSCAddressTable::TargetMap m_targets; ///< every target, only changed by the thread loading the session
+	pthread_mutex_t m_targetLock; ///< held while changing m_targets and publishing
+	/// a handle for every address that ever had a target, it keeps it for the life of the server
+	/// so a client resolves its handles once and they survive a reload
+	OSCAddressTable::HandleMap m_handles;
+	OSCAddressTable* volatile m_table; ///< what the liblo thread dispatches with
+	std::vector<OSCAddressTable*> m_retiredTables; ///< replaced but perhaps still in use
+	volatile int m_dispatching; ///< non zero while the liblo thread is inside lo_cb_dispatch
 };
 }
 
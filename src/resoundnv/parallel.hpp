@@ -0,0 +1,121 @@
+//    Resound
+//    Copyright 2009 David Moore and James Mooney
+//
+//    This file is part of Resound.
+//
+//    Resound is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    Resound is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Resound; if not, write to the Free Software
+//    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+#pragma once
+
+#include "resound_types.hpp"
+#include "behaviour.hpp"
+#include "dspstats.hpp"
+#include <semaphore.h>
+
+/// a pool of realtime worker threads that the jack thread can hand dsp work to.
+/// the calling thread always takes part so a pool of N threads starts N-1 workers.
+class DspWorkerPool {
+public:
+	/// a unit of work, called once for every item index
+	typedef void (*DspJobFunc)(void* arg, int item);
+private:
+	typedef std::vector<pthread_t> ThreadVector;
+	ThreadVector threads_;
+	sem_t start_; ///< posted once per worker to start a job
+	sem_t done_; ///< posted by each worker as it finishes a job
+	volatile bool continue_;
+
+	// the current job
+	DspJobFunc func_;
+	void* arg_;
+	int itemCount_;
+	volatile int nextItem_;
+public:
+	/// create the worker threads, realtime if jack is running realtime
+	DspWorkerPool(JackEngine* jack, int threadCount);
+	~DspWorkerPool();
+
+	/// the number of threads including the caller
+	int get_thread_count() const { return threads_.size() + 1; }
+
+	/// call func for every item in [0,count) spread across the pool
+	/// returns once every item is complete, safe to call from the jack thread
+	void run(DspJobFunc func, void* arg, int count);
+private:
+	void run_items();
+	void worker_loop();
+	static void* worker_thread(void* arg);
+};
+
+/// a plan for processing a set of behaviours concurrently.
+/// behaviours are split into tasks, bus writing behaviours get one task per bus lane,
+/// then tasks are grouped into levels where no two tasks in a level touch the same buffer
+/// in a conflicting way. levels run one after another in the serial order so every buffer
+/// sees exactly the same sequence of operations, the output is bit-identical to the serial path.
+class DspSchedule {
+public:
+	typedef std::vector<Behaviour*> BehaviourVector;
+	typedef std::vector<Loudspeaker*> LoudspeakerVector;
+private:
+	/// a chain of behaviours run in order by one thread
+	struct Task {
+		BehaviourVector behaviours;
+		std::vector<DspTimer*> timers; ///< one per behaviour
+		int lane; ///< ALL_LANES runs process, otherwise process_lane
+		AudioBufferSet reads;
+		AudioBufferSet writes;
+		Task() : lane(ALL_LANES) {}
+	};
+	typedef std::vector<Task> TaskVector;
+	typedef std::vector<TaskVector> LevelVector;
+
+	LevelVector levels_;
+	BehaviourVector laneBehaviours_; ///< behaviours needing process_control each block
+	std::vector<DspTimer*> laneBehaviourTimers_;
+	LoudspeakerVector loudspeakers_;
+	std::vector<DspTimer*> loudspeakerTimers_;
+	std::vector<LoudspeakerVector> laneLoudspeakers_;
+	std::vector<std::vector<DspTimer*> > laneLoudspeakerTimers_;
+
+	// block state for the job callbacks
+	jack_nframes_t offset_;
+	jack_nframes_t nframes_;
+	TaskVector* currentLevel_;
+public:
+	/// plan the given behaviours, which must be in serial processing order, over a number of lanes.
+	/// the routes of the mixed behaviours are summed by a MixMatrix, they only get process_control.
+	/// every behaviour and loudspeaker must have a timer in stats.
+	DspSchedule(const BehaviourVector& behaviours, const std::set<Behaviour*>& mixed, const LoudspeakerVector& loudspeakers, int lanes, DspStats& stats);
+
+	/// clear the loudspeaker buses at the start of a block
+	void pre_process(jack_nframes_t nframes);
+	/// process frames [offset, offset+nframes) of the block using the worker pool
+	void process(DspWorkerPool& pool, jack_nframes_t offset, jack_nframes_t nframes);
+	/// output the loudspeaker buses at the end of a block
+	void post_process(DspWorkerPool& pool, jack_nframes_t nframes);
+
+	/// print the plan for debugging
+	void print();
+
+	/// the level running b, every buffer b touches is in use for that whole level.
+	/// -1 if b only gets process_control
+	int get_level(Behaviour* b) const;
+private:
+	static bool conflicts(const Task& a, const Task& b);
+	static bool can_merge(const TaskVector& a, const TaskVector& b);
+	static void merge_lanes(TaskVector& into, const TaskVector& from);
+
+	static void run_task(void* arg, int item);
+	static void run_post_process(void* arg, int item);
+};
@@ -0,0 +1,116 @@
+//    Resound
+//    Copyright 2009 David Moore and James Mooney
+//
+//    This file is part of Resound.
+//
+//    Resound is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    Resound is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Resound; if not, write to the Free Software
+//    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <set>
+#include <jack/jack.h>
+
+class BParam;
+
+/// single producer, single consumer lock free queue of parameter changes.
+/// the osc thread posts, the jack thread drains at the top of every block so
+/// changes land together on a block boundary.
+/// a parameter is only ever queued once, later posts just replace its pending value,
+/// so any number of updates to one parameter within a block collapse into one.
+class ParamQueue {
+	std::vector<BParam*> slots_;
+	size_t mask_;
+	volatile size_t writeIndex_; ///< only written by the producer
+	volatile size_t readIndex_; ///< only written by the consumer
+
+	// statistics, written by one side only
+	volatile unsigned int posted_;
+	volatile unsigned int collapsed_;
+	volatile unsigned int dropped_;
+	volatile unsigned int applied_;
+	volatile unsigned int highWater_;
+public:
+	/// capacity is rounded up to a power of two
+	ParamQueue(size_t capacity);
+
+	/// producer side, queue a new value for a parameter
+	void post(BParam* param, float value);
+
+	/// consumer side, apply every pending change. realtime safe.
+	void drain();
+
+	/// the number of parameters currently waiting
+	size_t get_depth() const { return (writeIndex_ - readIndex_) & mask_; }
+	size_t get_capacity() const { return slots_.size() - 1; }
+	unsigned int get_high_water() const { return highWater_; }
+	unsigned int get_posted() const { return posted_; }
+	unsigned int get_collapsed() const { return collapsed_; }
+	unsigned int get_dropped() const { return dropped_; }
+	unsigned int get_applied() const { return applied_; }
+};
+
+/// true if jack frame a comes before frame b, allowing for the frame counter wrapping
+inline bool frame_before(jack_nframes_t a, jack_nframes_t b){ return (int)(a - b) < 0; }
+
+/// a parameter change due at a given jack frame
+struct TimedParamEvent {
+	BParam* param;
+	float value;
+	jack_nframes_t frame;
+	TimedParamEvent() : param(0), value(0.0f), frame(0) {}
+	TimedParamEvent(BParam* p, float v, jack_nframes_t f) : param(p), value(v), frame(f) {}
+};
+
+/// single producer, single consumer lock free queue of parameter changes due at a given jack frame.
+/// the osc thread posts changes from timetagged bundles, the jack thread moves them into a time
+/// ordered list and applies each one on its frame by splitting the block into sub blocks.
+class TimedParamQueue {
+	std::vector<TimedParamEvent> slots_;
+	size_t mask_;
+	volatile size_t writeIndex_;
+	volatile size_t readIndex_;
+
+	/// events waiting for their frame, sorted by frame, only touched by the consumer
+	std::vector<TimedParamEvent> pending_;
+	size_t pendingCount_;
+
+	volatile unsigned int posted_;
+	volatile unsigned int dropped_;
+	volatile unsigned int late_;
+	volatile unsigned int overflowed_;
+public:
+	/// capacity is rounded up to a power of two, the same number of events may wait for their frame
+	TimedParamQueue(size_t capacity);
+
+	/// producer side, queue a change for a frame
+	void post(BParam* param, float value, jack_nframes_t frame);
+
+	/// consumer side, collect newly posted events into the pending list.
+	/// blockStart is the first frame of the current block, anything earlier is late.
+	void fetch(jack_nframes_t blockStart);
+	/// consumer side, apply every pending event due at or before frame
+	void apply_due(jack_nframes_t frame);
+	/// consumer side, frames from frame until the next pending event or limit, whichever is sooner
+	jack_nframes_t frames_until_next(jack_nframes_t frame, jack_nframes_t limit) const;
+	/// consumer side, forget pending events for parameters that are about to be deleted
+	void purge(const std::set<BParam*>& params);
+
+	size_t get_pending() const { return pendingCount_; }
+	unsigned int get_posted() const { return posted_; }
+	unsigned int get_dropped() const { return dropped_; }
+	unsigned int get_late() const { return late_; }
+	unsigned int get_overflowed() const { return overflowed_; }
+};
@@ -0,0 +1,52 @@
+//    Resound
+//    Copyright 2009 David Moore and James Mooney
+//
+//    This file is part of Resound.
+//
+//    Resound is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    Resound is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Resound; if not, write to the Free Software
+//    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+#pragma once
+
+#include "resound_types.hpp"
+#include <sndfile.h>
+
+/// drives a session without a jack server, as fast as the cpu allows, writing every loudspeaker to disk.
+/// the session must have been initialised offline.
+class OfflineRenderer {
+	/// a livestream fed from a file
+	struct Input {
+		JackPort* port;
+		SNDFILE* file;
+	};
+	typedef std::vector<Input> InputVector;
+	InputVector inputs_;
+	typedef std::vector<SNDFILE*> OutputVector;
+	OutputVector outputs_;
+	std::vector<float> interleaved_;
+	ResoundSession& session_;
+public:
+	OfflineRenderer(ResoundSession& session);
+	~OfflineRenderer();
+
+	/// feed a livestream from a mono sound file, spec is livestream=file
+	void add_input(const std::string& spec);
+
+	/// render seconds of audio to path, 0 renders the longest diskstream.
+	/// split writes one mono file per loudspeaker, otherwise one file with a channel per loudspeaker
+	void run(const std::string& path, bool split, float seconds);
+private:
+	void open_outputs(const std::string& path, bool split);
+	void read_inputs(jack_nframes_t nframes);
+	void write_outputs(jack_nframes_t nframes);
+};
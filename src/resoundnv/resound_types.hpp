@@ -5,6 +5,7 @@
 #include <sstream>
 #include <vector>
 #include <list>
+#include <set>
 #include <map>
 #include <iostream>
 
@@ -47,6 +48,9 @@ public:
 	virtual void init_from_xml(const xmlpp::Element* nodeElement);
 	virtual ~DynamicObject(){}; 
 	const ObjectId& get_id(){return id_;}
+protected:
+	/// name an object the session builds itself rather than from xml
+	void set_id(const ObjectId& id){id_ = id;}
 };
 
 class ResoundApp {
@@ -0,0 +1,168 @@
+//    Resound
+//    Copyright 2009 David Moore and James Mooney
+//
+//    This file is part of Resound.
+//
+//    Resound is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    Resound is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Resound; if not, write to the Free Software
+//    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include "resoundnv/core.hpp"
+#include "resoundnv/render.hpp"
+#include <unistd.h>
+#include <csignal>
+
+#include <boost/program_options.hpp>
+
+// ------------------------------- Globals and entry point -----------------------------------
+
+CLIOptions g_options;
+
+void parse_command_arguments(int argc, char** argv){
+	// making use of boost::program options to deal with command arguments
+	namespace po = boost::program_options;
+
+	po::options_description desc("Usage: resoundnv-server");
+	desc.add_options()
+		("help", "Display this help message.")
+		("input", po::value<std::string>(&g_options.inputXML_)->default_value(g_options.inputXML_), "Input resound xml file, must be set!")
+		("port", po::value<std::string>(&g_options.oscPort_)->default_value(g_options.oscPort_), "OSC listening port")
+		("executor", po::value<std::string>(&g_options.executor_)->default_value(g_options.executor_), "DSP executor, serial or parallel")
+		("threads", po::value<int>(&g_options.dspThreads_)->default_value(g_options.dspThreads_), "Number of threads for the parallel executor, 0 uses every cpu")
+		("kernel", po::value<std::string>(&g_options.kernel_)->default_value(g_options.kernel_), "Buffer kernels, auto picks the widest the cpu supports, or avx512, avx2, sse2, scalar")
+		("copy-in", "Copy every livestream capture port into a private buffer, rather than reading it in place")
+		("copy-out", "Sum loudspeakers into a private buffer and copy it to the jack port, rather than summing into the port buffer")
+		("no-reuse", "Give every behaviour buffer its own storage, rather than sharing storage between buffers that are never live at once")
+		("no-matrix", "Sum every route in its own behaviour, rather than summing the routes of every routeset behaviour in one mix matrix")
+		("hugepages", "Back the audio buffers with hugepages, falls back to normal pages if none are reserved")
+		("meter-rate", po::value<float>(&g_options.meterRate_)->default_value(g_options.meterRate_), "Meter feedback updates per second, the fastest a client can subscribe to")
+		("read-ahead", po::value<float>(&g_options.readAhead_)->default_value(g_options.readAhead_), "Seconds of audio each diskstream reads ahead of playback")
+		("disk-threads", po::value<int>(&g_options.diskThreads_)->default_value(g_options.diskThreads_), "Number of threads reading diskstreams, so one slow file does not hold up the others")
+		("ramp", po::value<float>(&g_options.rampTime_)->default_value(g_options.rampTime_), "Milliseconds route levels and smoothed parameters take to ramp to a new value, unless the xml gives a ramp")
+		("param-queue", po::value<int>(&g_options.paramQueueSize_)->default_value(g_options.paramQueueSize_), "Number of distinct OSC parameter changes that can wait for one block")
+		("timed-queue", po::value<int>(&g_options.timedQueueSize_)->default_value(g_options.timedQueueSize_), "Number of timetagged OSC parameter changes that can wait for their frame")
+		("render", po::value<std::string>(&g_options.render_)->default_value(g_options.render_), "Render offline to this wav file as fast as possible instead of running with jack")
+		("render-split", "Render one mono file per loudspeaker, named file.<loudspeaker>.wav")
+		("render-length", po::value<float>(&g_options.renderLength_)->default_value(g_options.renderLength_), "Seconds to render, 0 renders the longest diskstream")
+		("render-input", po::value<std::vector<std::string> >(&g_options.renderInputs_)->composing(), "Feed a livestream from a mono file when rendering, as livestream=file, may be repeated")
+		("sample-rate", po::value<int>(&g_options.renderSampleRate_)->default_value(g_options.renderSampleRate_), "Sample rate when rendering")
+		("buffer-size", po::value<int>(&g_options.renderBufferSize_)->default_value(g_options.renderBufferSize_), "Block size when rendering")
+		("test", "Runs some internal testing code")
+		//("record", po::value<std::string>(), "Record loudspeakers to wav file <filename>.")
+		//("simulate", po::value<int>(), "Loudspeakers are simulated as point sources")
+
+	;
+
+	po::variables_map vm;
+	po::store(po::parse_command_line(argc, argv, desc), vm);
+	po::notify(vm);    
+
+	if (vm.count("help")) {
+		std::cout << desc << "\n";
+		exit(1);
+	}
+
+	g_options.renderSplit_ = vm.count("render-split") > 0;
+	g_options.hugePages_ = vm.count("hugepages") > 0;
+	g_options.copyOut_ = vm.count("copy-out") > 0;
+	g_options.copyIn_ = vm.count("copy-in") > 0;
+	g_options.reuseBuffers_ = vm.count("no-reuse") == 0;
+	g_options.mixMatrix_ = vm.count("no-matrix") == 0;
+	g_options.offline_ = g_options.render_ != "";
+
+	if (vm.count("test")) {
+		test_dsp();
+		exit(1);
+	}
+
+	if (g_options.inputXML_ == ""){
+		std::cout << "Cannot continue, input resound XML file must be specified!\n";
+		std::cout << desc << "\n";
+		exit(1);
+	}
+
+}
+
+ResoundSession* g_session = 0;
+bool g_continue = false;
+
+void handle_sigint(int sig){
+        signal(SIGINT, handle_sigint);
+        g_continue = false;
+        printf("Interupted - shutting down\n");
+}
+
+void handle_sighup(int sig){
+        signal(SIGHUP, handle_sighup);
+        if(g_session) g_session->request_reload();
+}
+
+int main(int argc, char** argv){
+
+	parse_command_arguments(argc,argv);
+	// for now we take the first arg and use it as the filename for xml
+	std::cout << "resoundnv server v0.0.1\n";
+	std::cout << "Loading config from " << g_options.inputXML_ << std::endl;
+
+	// loading and parsing the xml
+//	try
+//	{
+		xmlpp::DomParser parser;
+		parser.set_validate(false);
+		parser.set_substitute_entities(); //We just want the text to be resolved/unescaped automatically.
+		parser.parse_file(g_options.inputXML_);
+		if(parser){
+			const xmlpp::Node* pNode = parser.get_document()->get_root_node(); //deleted by DomParser.
+			const xmlpp::Element* nodeElement = dynamic_cast<const xmlpp::Element*>(pNode);
+			if(nodeElement)
+			{	
+				std::string name = nodeElement->get_name();
+				if(name=="resoundnv"){
+					std::cout << "Resoundnv XML node found, building session.\n";
+					g_session = new ResoundSession(g_options);
+					APP().set_session(g_session);
+					SESSION().load_from_xml(nodeElement);
+				}
+			}
+		}
+//	}
+//	catch(const std::exception& ex){
+//		std::cout << "XML Initialisation file parsing exception what()=" << ex.what() << std::endl;
+//		std::cout << "Server cannot continue"<< std::endl;
+//		std::exit(1);
+//	}
+        if(g_session && g_options.render_ != ""){
+                // offline, render then exit
+                OfflineRenderer renderer(*g_session);
+                for(unsigned int n = 0; n < g_options.renderInputs_.size(); ++n){
+                        renderer.add_input(g_options.renderInputs_[n]);
+                }
+                renderer.run(g_options.render_, g_options.renderSplit_, g_options.renderLength_);
+                delete g_session;
+                g_session=0;
+                return 0;
+        }
+        signal(SIGINT, handle_sigint);
+        signal(SIGHUP, handle_sighup);
+        g_continue = true;
+	while(g_continue){ // TODO this should really listen for incoming signals, see unix programming book.
+		usleep(g_options.meterRate_ > 0.0f ? (useconds_t)(1000000.0f / g_options.meterRate_) : 100000);
+		// use this thread to send some feedback and drop clients that stopped pinging
+                if(g_session) g_session->poll_reload();
+                if(g_session) g_session->poll_expiry();
+                if(g_session) g_session->send_osc_feedback();
+	}
+        delete g_session; // should invoke destructor
+        g_session=0;
+        return 0;
+}
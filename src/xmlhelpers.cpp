@@ -2,6 +2,8 @@
 #include "resoundnv/xmlhelpers.hpp"
 #include "resoundnv/resound_exception.hpp"
 #include <cstdlib>
+#include <map>
+#include <sstream>
 
 const xmlpp::Element* get_element(const xmlpp::Node* node){
 	const xmlpp::Element* nodeElement = dynamic_cast<const xmlpp::Element*>(node);
@@ -36,3 +38,29 @@ float get_optional_attribute_float(const xmlpp::Element* node, const std::string
 		return def;
 	}
 }
+std::string get_element_signature(const xmlpp::Element* node){
+	// attributes are sorted so that reordering them does not count as a change
+	std::map<std::string, std::string> attributes;
+	const xmlpp::Element::AttributeList list = node->get_attributes();
+	for(xmlpp::Element::AttributeList::const_iterator it = list.begin(); it != list.end(); ++it){
+		attributes[(*it)->get_name()] = (*it)->get_value();
+	}
+	std::stringstream str;
+	str << "<" << node->get_name();
+	for(std::map<std::string, std::string>::iterator it = attributes.begin(); it != attributes.end(); ++it){
+		str << " " << it->first << "=\"" << it->second << "\"";
+	}
+	str << ">";
+	xmlpp::Node::NodeList nodes = node->get_children();
+	for(xmlpp::Node::NodeList::iterator it = nodes.begin(); it != nodes.end(); ++it){
+		const xmlpp::Element* child = dynamic_cast<const xmlpp::Element*>(*it);
+		const xmlpp::TextNode* text = dynamic_cast<const xmlpp::TextNode*>(*it);
+		if(child){
+			str << get_element_signature(child);
+		} else if(text && !text->is_white_space()){
+			str << text->get_content();
+		}
+	}
+	str << "</" << node->get_name() << ">";
+	return str.str();
+}